@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+//
+// Helpers for benchmarks. Results are printed as one json object per line on stdout so they can be collected and
+// compared between runs, like {"bench":"scrape","items":1000,"ns":1234.5}.
+//
+
+namespace bench {
+
+   using clock = std::chrono::steady_clock;
+   
+   // One benchmark result line, printed when destroyed.
+   struct result
+   {
+      result(const std::string& bench) { _os << std::setprecision(15) << "{\"bench\":\"" << bench << '"'; }
+
+      result(const result&) = delete;
+      result& operator=(const result&) = delete;
+      
+      result& operator()(const char* name, double value) { _os << ",\"" << name << "\":" << value; return *this; }
+      result& operator()(const char* name, const std::string& value)
+      {
+         _os << ",\"" << name << "\":\"" << value << '"';
+         return *this;
+      }
+
+      ~result() { std::cout << _os.str() << '}' << std::endl; }
+      
+   private:
+      std::ostringstream _os;
+   };
+
+   // Nanoseconds elapsed since start.
+   inline double ns_since(clock::time_point start)
+   {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+   }
+}
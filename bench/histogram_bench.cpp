@@ -0,0 +1,60 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <glo.hpp>
+
+#include "bench.hpp"
+
+//
+// Benchmark of glo::histogram::record from 1 to 8 threads, and of reading percentiles.
+//
+
+using namespace std::chrono;
+
+constexpr uint64_t RECORDS_PER_THREAD = 10 * 1000 * 1000;
+
+int main()
+{
+   for (uint32_t threads : {1, 2, 4, 8}) {
+      glo::histogram histogram;
+      std::vector<std::thread> workers;
+      auto start = steady_clock::now();
+      for (uint32_t i = 0; i < threads; ++i) {
+         workers.emplace_back([&histogram, i]() {
+               // Vary the values to hit different buckets, like real durations.
+               uint64_t value = 1000 + i;
+               for (uint64_t j = 0; j < RECORDS_PER_THREAD; ++j) {
+                  histogram.record(value);
+                  value = (value * 7 + 13) & 0x1ffff;
+               }
+            });
+      }
+      for (auto& w : workers) {
+         w.join();
+      }
+      auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+      if (histogram.count() != threads * RECORDS_PER_THREAD) {
+         std::cerr << "bad count" << std::endl;
+         return 1;
+      }
+      
+      bench::result("histogram_record")("threads", threads)("ns", double(ns) / double(threads * RECORDS_PER_THREAD));
+   }
+
+   glo::histogram histogram;
+   for (uint64_t i = 0; i < 100000; ++i) {
+      histogram.record(i * 10);
+   }
+   uint64_t sum = 0;
+   constexpr uint32_t READS = 10000;
+   auto start = steady_clock::now();
+   for (uint32_t i = 0; i < READS; ++i) {
+      sum += histogram.percentile(0.99);
+   }
+   auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+   bench::result("histogram_percentile")("ns", double(ns) / READS)("value", double(sum / READS));
+   
+   return 0;
+}
@@ -0,0 +1,124 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glo.hpp>
+
+#include "bench.hpp"
+
+//
+// End to end benchmark of http_status_server over loopback, requests/s with keep-alive connections for different
+// numbers of items, clients and snapshot max age.
+//
+
+using namespace std::chrono;
+
+// Connect to the server on localhost.
+int connect_to(uint16_t port)
+{
+   int fd = socket(AF_INET6, SOCK_STREAM, 0);
+   sockaddr_in6 addr{};
+   addr.sin6_family = AF_INET6;
+   addr.sin6_port = htons(port);
+   addr.sin6_addr = in6addr_loopback;
+   if (fd == -1 or connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+      throw glo::os_error("failed to connect");
+   }
+   int one = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   return fd;
+}
+
+// Send a request and read the full response on a keep-alive connection, returns the response size.
+size_t request(int fd, std::string& response)
+{
+   static const char* REQUEST = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+   if (send(fd, REQUEST, strlen(REQUEST), MSG_NOSIGNAL) == -1) {
+      throw glo::os_error("failed to send");
+   }
+   response.clear();
+   size_t header_end = std::string::npos;
+   size_t content_length = 0;
+   char buf[64 * 1024];
+   while (header_end == std::string::npos or response.size() < header_end + content_length) {
+      auto n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0) {
+         throw glo::os_error("failed to receive");
+      }
+      response.append(buf, size_t(n));
+      if (header_end == std::string::npos) {
+         auto end = response.find("\r\n\r\n");
+         if (end != std::string::npos) {
+            header_end = end + 4;
+            auto pos = response.find("Content-Length: ");
+            content_length = std::stoul(response.substr(pos + 16));
+         }
+      }
+   }
+   return response.size();
+}
+
+void bench_requests(uint32_t items, uint32_t clients, milliseconds max_age)
+{
+   std::vector<uint64_t> values(items);
+   glo::http_status_server server;
+   auto group = std::make_shared<glo::group>("/bench");
+   for (uint32_t i = 0; i < items; ++i) {
+      group->add(&values[i], "/value" + std::to_string(i), {glo::tag::COUNT}, glo::level::MEDIUM, "Value.");
+   }
+   server.add_group(group);
+   server.start(max_age);
+
+   std::atomic<bool> stop(false);
+   std::vector<uint64_t> requests(clients);
+   std::vector<uint64_t> bytes(clients);
+   std::vector<std::thread> threads;
+   auto start = bench::clock::now();
+   for (uint32_t i = 0; i < clients; ++i) {
+      threads.emplace_back([&, i]() {
+            int fd = connect_to(server.port());
+            glo::close_guard guard(fd);
+            std::string response;
+            while (not stop.load()) {
+               bytes[i] += request(fd, response);
+               ++requests[i];
+            }
+         });
+   }
+   std::this_thread::sleep_for(milliseconds(500));
+   stop = true;
+   for (auto& thread : threads) {
+      thread.join();
+   }
+   auto ns = bench::ns_since(start);
+   server.stop();
+
+   uint64_t total_requests = 0;
+   uint64_t total_bytes = 0;
+   for (uint32_t i = 0; i < clients; ++i) {
+      total_requests += requests[i];
+      total_bytes += bytes[i];
+   }
+   bench::result("http")("items", items)("clients", clients)("max_age_ms", double(max_age.count()))
+      ("requests_per_s", double(total_requests) / ns * 1e9)("bytes_per_s", double(total_bytes) / ns * 1e9);
+}
+
+int main()
+{
+   for (uint32_t items : {10, 1000, 100000}) {
+      for (uint32_t clients : {1, 8}) {
+         bench_requests(items, clients, milliseconds(0));
+         bench_requests(items, clients, milliseconds(50));
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,162 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <glo.hpp>
+
+#include "bench.hpp"
+
+//
+// Benchmark of reading values with group::json_format_items: scrape latency and bytes/s for 10 to 1M items with
+// different value types and group depths, value mutex hold time and throughput of writer threads sharing the value
+// mutex with the scraper.
+//
+
+using namespace std::chrono;
+
+// Values for a group tree, items are spread over groups of at most GROUP_SIZE values.
+struct tree
+{
+   static constexpr uint32_t GROUP_SIZE = 100;
+
+   // Build tree with items values of type ("fundamental", "atomic", "string" or "mixed"), with groups nested depth
+   // levels deep, all using mutex.
+   tree(uint32_t items, const std::string& type, uint32_t depth, const std::shared_ptr<std::mutex>& mutex)
+      : uints(items), atomics(items), strings(items, "value")
+   {
+      std::vector<std::shared_ptr<glo::group>> parents(depth);
+      std::shared_ptr<glo::group> group;
+      for (uint32_t i = 0; i < items; ++i) {
+         if (i % GROUP_SIZE == 0) {
+            group = std::make_shared<glo::group>("/group" + std::to_string(i / GROUP_SIZE), mutex);
+            auto parent = i / GROUP_SIZE % depth;
+            if (parent == 0) {
+               root.add_group(group);
+            }
+            else {
+               parents[parent - 1]->add_group(group);
+            }
+            parents[parent] = group;
+         }
+         auto key = "/value" + std::to_string(i);
+         auto kind = type == "mixed" ? i % 3 : type == "fundamental" ? 0 : type == "atomic" ? 1 : 2;
+         switch (kind) {
+            case 0: group->add(&uints[i], key, {glo::tag::COUNT}, glo::level::MEDIUM, "Fundamental."); break;
+            case 1: group->add(&atomics[i], key, {glo::tag::COUNT}, glo::level::MEDIUM, "Atomic."); break;
+            case 2: group->add(&strings[i], key, {}, glo::level::MEDIUM, "String."); break;
+         }
+      }
+   }
+
+   glo::group root;
+   std::vector<uint64_t> uints;
+   std::vector<std::atomic<uint64_t>> atomics;
+   std::vector<std::string> strings;
+};
+
+// Scrape root and return the number of bytes.
+size_t scrape(glo::group& root, glo::write_buffer& buf)
+{
+   buf.clear();
+   const char* delimiter = "";
+   root.json_format_items(buf, "", delimiter, glo::filter());
+   return buf.size();
+}
+
+void bench_scrape(uint32_t items, const std::string& type, uint32_t depth)
+{
+   auto mutex = std::make_shared<std::mutex>();
+   tree t(items, type, depth, mutex);
+   glo::write_buffer buf;
+
+   // The first scrape compiles the tree and grows the buffer.
+   auto start = bench::clock::now();
+   scrape(t.root, buf);
+   auto first_ns = bench::ns_since(start);
+
+   auto& hold_time = glo::lock_stats().hold_time;
+   auto hold_count = hold_time.count();
+   auto hold_sum = hold_time.sum();
+   
+   uint32_t runs = std::max(uint32_t(5), uint32_t(10 * 1000 * 1000 / items));
+   size_t size = 0;
+   start = bench::clock::now();
+   for (uint32_t i = 0; i < runs; ++i) {
+      size = scrape(t.root, buf);
+   }
+   auto ns = bench::ns_since(start) / runs;
+   auto holds = hold_time.count() - hold_count;
+   
+   bench::result("scrape")("items", items)("type", type)("depth", depth)("first_ns", first_ns)("ns", ns)
+      ("bytes", double(size))("bytes_per_s", double(size) / ns * 1e9)
+      ("lock_hold_ns", holds ? double(hold_time.sum() - hold_sum) / double(holds) : 0)
+      ("lock_holds_per_scrape", double(holds) / runs);
+}
+
+void bench_writers(uint32_t writers, bool scraping)
+{
+   constexpr uint32_t ITEMS = 10000;
+   auto mutex = std::make_shared<std::mutex>();
+   tree t(ITEMS, "fundamental", 1, mutex);
+
+   std::atomic<bool> stop(false);
+   std::vector<std::thread> threads;
+   std::vector<uint64_t> ops(writers);
+   for (uint32_t i = 0; i < writers; ++i) {
+      threads.emplace_back([&, i]() {
+            uint64_t n = 0;
+            while (not stop.load(std::memory_order_relaxed)) {
+               std::lock_guard<std::mutex> lock(*mutex);
+               ++t.uints[(n * 7919 + i) % ITEMS];
+               ++n;
+            }
+            ops[i] = n;
+         });
+   }
+
+   glo::write_buffer buf;
+   uint64_t scrapes = 0;
+   auto start = bench::clock::now();
+   auto end = start + milliseconds(500);
+   while (bench::clock::now() < end) {
+      if (scraping) {
+         scrape(t.root, buf);
+         ++scrapes;
+      }
+      else {
+         std::this_thread::sleep_for(milliseconds(10));
+      }
+   }
+   stop = true;
+   for (auto& thread : threads) {
+      thread.join();
+   }
+   auto ns = bench::ns_since(start);
+   
+   uint64_t total = 0;
+   for (auto n : ops) {
+      total += n;
+   }
+   bench::result("writers")("items", ITEMS)("writers", writers)("scraping", scraping ? "true" : "false")
+      ("writer_ops_per_s", double(total) / ns * 1e9)("scrape_ns", scrapes ? ns / double(scrapes) : 0);
+}
+
+int main()
+{
+   for (uint32_t items : {10, 100, 1000, 10000, 100000, 1000000}) {
+      bench_scrape(items, "mixed", 1);
+   }
+   for (auto type : {"fundamental", "atomic", "string"}) {
+      bench_scrape(10000, type, 1);
+   }
+   for (uint32_t depth : {10, 100}) {
+      bench_scrape(10000, "mixed", depth);
+   }
+   for (uint32_t writers : {1, 4, 16}) {
+      bench_writers(writers, false);
+      bench_writers(writers, true);
+   }
+   return 0;
+}
@@ -0,0 +1,63 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <glo.hpp>
+
+#include "bench.hpp"
+
+//
+// Benchmark of concurrent increments of a glo::sharded_counter compared to a plain std::atomic, at 1 to 64 threads.
+//
+
+using namespace std::chrono;
+
+constexpr uint64_t INCREMENTS_PER_THREAD = 2 * 1000 * 1000;
+
+// Run increment in threads threads, returning wall clock ns per increment for all threads together.
+template<typename Increment>
+double run(uint32_t threads, Increment increment)
+{
+   std::atomic<uint32_t> ready(0);
+   std::atomic<bool> go(false);
+   std::vector<std::thread> workers;
+   for (uint32_t i = 0; i < threads; ++i) {
+      workers.emplace_back([&]() {
+            ++ready;
+            while (not go.load()) std::this_thread::yield();
+            for (uint64_t j = 0; j < INCREMENTS_PER_THREAD; ++j) {
+               increment();
+            }
+         });
+   }
+   while (ready.load() < threads) std::this_thread::yield();
+   auto start = steady_clock::now();
+   go = true;
+   for (auto& w : workers) {
+      w.join();
+   }
+   auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+   return double(ns) / double(threads * INCREMENTS_PER_THREAD);
+}
+
+int main()
+{
+   for (uint32_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+      std::atomic<uint64_t> atomic_counter(0);
+      double atomic_ns = run(threads, [&]() { atomic_counter.fetch_add(1, std::memory_order_relaxed); });
+      
+      glo::sharded_counter sharded_counter;
+      double sharded_ns = run(threads, [&]() { ++sharded_counter; });
+
+      if (atomic_counter.load() != threads * INCREMENTS_PER_THREAD
+          or sharded_counter.load() != threads * INCREMENTS_PER_THREAD) {
+         std::cerr << "bad count" << std::endl;
+         return 1;
+      }
+      
+      bench::result("counter_increment")("type", "atomic")("threads", threads)("ns", atomic_ns);
+      bench::result("counter_increment")("type", "sharded_counter")("threads", threads)("ns", sharded_ns);
+   }
+   return 0;
+}
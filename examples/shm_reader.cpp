@@ -0,0 +1,37 @@
+#include <iostream>
+#include <glo.hpp>
+
+//
+// Tool reading a file written by glo::shm_exporter, printing key, level and value of each item once or every interval.
+//
+// Usage: shm_reader <path> [interval in ms]
+//
+
+int main(int argc, char** argv)
+{
+   if (argc < 2) {
+      std::cerr << "usage: " << argv[0] << " <path> [interval in ms]" << std::endl;
+      return 1;
+   }
+   int interval = argc > 2 ? atoi(argv[2]) : 0;
+   
+   glo::shm_reader reader(argv[1]);
+   glo::write_buffer data;
+   std::vector<glo::binary_item> items;
+   while (true) {
+      if (reader.load(data) and glo::binary_parse(data.data(), data.size(), items)) {
+         for (auto& item : items) {
+            std::cout << item.key << " " << item.level << " ";
+            if (item.type == glo::binary_type::NONE) std::cout << "-";
+            else if (item.type == glo::binary_type::UINT64) std::cout << item.value;
+            else std::cout << item.number();
+            std::cout << "\n";
+         }
+         std::cout << std::endl;
+      }
+      if (interval <= 0) {
+         return 0;
+      }
+      usleep(interval * 1000);
+   }
+}
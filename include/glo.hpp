@@ -2,4 +2,8 @@
 
 #include <glo/common.hpp>
 #include <glo/status_group.hpp>
+#include <glo/sharded_counter.hpp>
+#include <glo/histogram.hpp>
+#include <glo/seqlock_value.hpp>
 #include <glo/http_status_server.hpp>
+#include <glo/shm_exporter.hpp>
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <glo/common.hpp>
+
+
+namespace glo {
+
+   //
+   // Helpers for the compact binary format for machine collectors. All numbers are little-endian. A response is:
+   //
+   // header, 32 bytes:
+   //   magic "GLOB" (4 bytes), u32 format version (BINARY_FORMAT_VERSION), u64 schema version, f64 timestamp (seconds
+   //   since epoch), u32 item count (n), u32 schema size in bytes (0 if the schema is left out)
+   //
+   // schema, only if schema size is not 0, per item in table order:
+   //   u32 key size, key (including tags, same as the json key), u32 level, u32 desc size, desc
+   //
+   // types, n bytes padded with zeros to a multiple of 8, one binary_type per item
+   //
+   // values, n * 8 bytes, per item u64, i64 or f64 depending on type (0 for none)
+   //
+   // The schema version is a hash of the schema, a collector that already has the schema with that version can pass it
+   // and the schema is left out. Items are in the same order as long as the schema version is the same. Values that
+   // are not numbers or booleans (or could not be read) are of type none. The type of an item is decided by its C++
+   // type (booleans are u64), items of values formatted in other ways (like items of histograms, callbacks and
+   // custom formatters) are f64.
+   //
+
+   constexpr uint32_t BINARY_FORMAT_VERSION = 1;
+   constexpr size_t BINARY_HEADER_SIZE = 32;
+   constexpr size_t BINARY_SCHEMA_VERSION_OFFSET = 8;
+   constexpr size_t BINARY_SCHEMA_SIZE_OFFSET = 28;
+
+   // Value types.
+   using binary_type_t = uint8_t;
+   namespace binary_type {
+      static const binary_type_t NONE = 0;
+      static const binary_type_t UINT64 = 1;
+      static const binary_type_t INT64 = 2;
+      static const binary_type_t FLOAT64 = 3;
+   }
+
+   // Append value as little-endian.
+   inline void binary_append_u32(write_buffer& buf, uint32_t value)
+   {
+      auto p = buf.extend(4);
+      for (int i = 0; i < 4; ++i) p[i] = char(value >> (8 * i));
+   }
+   inline void binary_append_u64(write_buffer& buf, uint64_t value)
+   {
+      auto p = buf.extend(8);
+      for (int i = 0; i < 8; ++i) p[i] = char(value >> (8 * i));
+   }
+   inline void binary_append_f64(write_buffer& buf, double value)
+   {
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      binary_append_u64(buf, bits);
+   }
+
+   // Read little-endian value at p.
+   inline uint64_t binary_read_u64(const char* p)
+   {
+      uint64_t value = 0;
+      for (int i = 0; i < 8; ++i) value |= uint64_t(uint8_t(p[i])) << (8 * i);
+      return value;
+   }
+   inline uint32_t binary_read_u32(const char* p)
+   {
+      uint32_t value = 0;
+      for (int i = 0; i < 4; ++i) value |= uint32_t(uint8_t(p[i])) << (8 * i);
+      return value;
+   }
+
+   // Append the header for items formatted by group::binary_format_items.
+   inline void binary_append_header(write_buffer& buf, uint64_t schema_version, double timestamp, size_t items,
+                                    size_t schema_size)
+   {
+      buf.append("GLOB");
+      binary_append_u32(buf, BINARY_FORMAT_VERSION);
+      binary_append_u64(buf, schema_version);
+      binary_append_f64(buf, timestamp);
+      binary_append_u32(buf, uint32_t(items));
+      binary_append_u32(buf, uint32_t(schema_size));
+   }
+
+   //
+   // An item parsed from the binary format, for readers.
+   //
+   struct binary_item
+   {
+      std::string key;
+      uint32_t level{0};
+      std::string desc;
+      binary_type_t type{binary_type::NONE};
+      uint64_t value{0};
+
+      // Value as double (0 for none).
+      inline double number() const;
+   };
+
+   // Parse a complete response of size bytes at data (with schema) into items, returns false if it is malformed or
+   // the schema is left out.
+   inline bool binary_parse(const char* data, size_t size, std::vector<binary_item>& items);
+   
+   // Hash (64 bit FNV-1a) of size bytes at data, used as schema version.
+   inline uint64_t binary_hash(const char* data, size_t size)
+   {
+      uint64_t hash = 14695981039346656037ull;
+      for (size_t i = 0; i < size; ++i) {
+         hash ^= uint8_t(data[i]);
+         hash *= 1099511628211ull;
+      }
+      return hash;
+   }
+
+   // Binary type of values of type T, none for types that are not numbers or booleans (char is formatted as a
+   // string).
+   template<typename T> constexpr binary_type_t binary_type_of()
+   {
+      return std::is_same<T, char>::value or not std::is_arithmetic<T>::value ? binary_type::NONE
+         : std::is_floating_point<T>::value ? binary_type::FLOAT64
+         : std::is_signed<T>::value ? binary_type::INT64
+         : binary_type::UINT64;
+   }
+
+   // Binary value of value with the type binary_type_of<T>().
+   template<typename T> typename std::enable_if<std::is_floating_point<T>::value, uint64_t>::type
+   binary_bits_of(T value)
+   {
+      double d = double(value);
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      return bits;
+   }
+   template<typename T> typename std::enable_if<std::is_integral<T>::value, uint64_t>::type binary_bits_of(T value)
+   {
+      return uint64_t(value);
+   }
+   template<typename T> typename std::enable_if<not std::is_arithmetic<T>::value, uint64_t>::type
+   binary_bits_of(const T& value)
+   {
+      return 0;
+   }
+
+   // Convert the json formatted value of size bytes at json to a binary value, for values where the type is not known
+   // from the C++ type. Returns float64 for numbers and booleans so the type does not change between values, otherwise
+   // none. Does not allocate.
+   inline binary_type_t binary_value(const char* json, size_t size, uint64_t& value)
+   {
+      value = 0;
+      double d;
+      if (size == 4 and memcmp(json, "true", 4) == 0) {
+         d = 1;
+      }
+      else if (size == 5 and memcmp(json, "false", 5) == 0) {
+         d = 0;
+      }
+      else {
+         // Null terminated copy for strtod, no json number is this long.
+         char str[64];
+         if (size == 0 or size >= sizeof(str)) {
+            return binary_type::NONE;
+         }
+         memcpy(str, json, size);
+         str[size] = 0;
+         if (strspn(str, "0123456789.eE+-naif") != size) {
+            return binary_type::NONE;
+         }
+         char* end;
+         d = strtod(str, &end);
+         if (*end != 0) {
+            return binary_type::NONE;
+         }
+      }
+      memcpy(&value, &d, sizeof(value));
+      return binary_type::FLOAT64;
+   }
+
+   //
+   // Implementation.
+   //
+
+   double binary_item::number() const
+   {
+      if (type == binary_type::INT64) return double(int64_t(value));
+      if (type == binary_type::FLOAT64) {
+         double d;
+         memcpy(&d, &value, sizeof(d));
+         return d;
+      }
+      return double(value);
+   }
+   
+   bool binary_parse(const char* data, size_t size, std::vector<binary_item>& items)
+   {
+      items.clear();
+      if (size < BINARY_HEADER_SIZE or memcmp(data, "GLOB", 4) != 0
+          or binary_read_u32(data + 4) != BINARY_FORMAT_VERSION) {
+         return false;
+      }
+      size_t count = binary_read_u32(data + 24);
+      size_t schema_size = binary_read_u32(data + BINARY_SCHEMA_SIZE_OFFSET);
+      size_t types_size = (count + 7) / 8 * 8;
+      if ((schema_size == 0 and count != 0) or size != BINARY_HEADER_SIZE + schema_size + types_size + count * 8) {
+         return false;
+      }
+      
+      // Read a u32 size and that many bytes into str.
+      const char* p = data + BINARY_HEADER_SIZE;
+      const char* end = p + schema_size;
+      auto read_str = [&p, end](std::string& str) {
+         if (end - p < 4 or size_t(end - p - 4) < binary_read_u32(p)) return false;
+         str.assign(p + 4, binary_read_u32(p));
+         p += 4 + str.size();
+         return true;
+      };
+      
+      items.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+         auto& item = items[i];
+         if (not read_str(item.key) or end - p < 4) {
+            return false;
+         }
+         item.level = binary_read_u32(p);
+         p += 4;
+         if (not read_str(item.desc)) {
+            return false;
+         }
+         item.type = binary_type_t(end[i]);
+         item.value = binary_read_u64(end + types_size + i * 8);
+      }
+      return p == end;
+   }
+}
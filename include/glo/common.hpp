@@ -1,10 +1,14 @@
 #pragma once
 
+#include <string.h>
 #include <unistd.h>
 
-#include <sstream>
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <memory>
+#include <sstream>
+#include <streambuf>
 #include <vector>
 
 namespace glo {
@@ -34,6 +38,11 @@ namespace glo {
       static const tag_t CURRENT("current");
       static const tag_t DURATION("duration");
       static const tag_t TIME("time");
+      static const tag_t MEAN("mean");
+      static const tag_t P50("p50");
+      static const tag_t P90("p90");
+      static const tag_t P99("p99");
+      static const tag_t P999("p999");
    }
 
    //
@@ -48,11 +57,195 @@ namespace glo {
       static const level_t LOWEST = 4;
    }
  
+   //
+   // Write buffer.
+   //
+
+   //
+   // Growable byte buffer used for formatting. Memory is kept when the buffer is cleared, so a buffer that is reused
+   // will not allocate once it has grown large enough.
+   //
+   struct write_buffer
+   {
+      write_buffer() {}
+
+      write_buffer(const write_buffer&) = delete;
+      write_buffer& operator=(const write_buffer&) = delete;
+
+      const char* data() const { return _data.get(); }
+      size_t size() const { return _size; }
+      bool empty() const { return _size == 0; }
+      void clear() { _size = 0; }
+
+      // Shrink the content to size bytes.
+      void truncate(size_t size) { _size = std::min(size, _size); }
+
+      // Make sure there is room for at least capacity bytes.
+      inline void reserve(size_t capacity);
+      
+      // Extend the content with size bytes and return a pointer to them, the caller should write all of them.
+      char* extend(size_t size) { reserve(_size + size); auto p = _data.get() + _size; _size += size; return p; }
+      
+      void append(const char* data, size_t size) { if (size) memcpy(extend(size), data, size); }
+      void append(const char* str) { append(str, strlen(str)); }
+      void append(const std::string& str) { append(str.data(), str.size()); }
+      void append(const write_buffer& buf) { append(buf.data(), buf.size()); }
+      void append(char c) { *extend(1) = c; }
+
+      std::string str() const { return std::string(data(), size()); }
+
+      // Stream writing to the end of the buffer (with precision 19), for formatters that only supports std::ostream.
+      inline std::ostream& stream();
+      
+   private:
+
+      struct streambuf : public std::streambuf
+      {
+         streambuf(write_buffer& buf) : _buf(buf) {}
+         
+         int_type overflow(int_type c) override
+         {
+            if (c != traits_type::eof()) _buf.append(char(c));
+            return c;
+         }
+         
+         std::streamsize xsputn(const char* s, std::streamsize n) override
+         {
+            _buf.append(s, size_t(n));
+            return n;
+         }
+         
+         write_buffer& _buf;
+      };
+      
+      std::unique_ptr<char[]> _data;
+      size_t _size{0};
+      size_t _capacity{0};
+      std::unique_ptr<streambuf> _streambuf;
+      std::unique_ptr<std::ostream> _stream;
+   };
+
+   void write_buffer::reserve(size_t capacity)
+   {
+      if (capacity <= _capacity) {
+         return;
+      }
+      auto new_capacity = std::max(capacity, std::max(_capacity * 2, size_t(256)));
+      std::unique_ptr<char[]> data(new char[new_capacity]);
+      if (_size) memcpy(data.get(), _data.get(), _size);
+      _data = std::move(data);
+      _capacity = new_capacity;
+   }
+   
+   std::ostream& write_buffer::stream()
+   {
+      if (not _stream) {
+         _streambuf = std::make_unique<streambuf>(*this);
+         _stream = std::make_unique<std::ostream>(_streambuf.get());
+         *_stream << std::setprecision(19);
+      }
+      return *_stream;
+   }
+   
+   //
+   // Value traits.
+   //
+
+   // Traits for value types added to a group, specialize value_traits for value types that needs special handling
+   // (inheriting default_value_traits).
+   template<typename T> struct default_value_traits
+   {
+      // True if the value can be read and formatted concurrently with writers, values added by raw pointer, std::ref
+      // or std::shared_ptr will then be formatted without holding the group mutex.
+      static constexpr bool lock_free = false;
+
+      // Tags always added to items with values of this type.
+      static tags_t tags() { return {}; }
+
+      // For lock free values that should be formatted as several items, pairs of tag and format function for each
+      // item. The tag is added to the tags of the item. Empty for values formatted as one item.
+      static std::vector<std::pair<tag_t, void (*)(write_buffer&, const T&)>> items() { return {}; }
+
+      // For values with items(), a Prometheus metric type for formatting the value as one metric family with
+      // prometheus_format instead of one metric per item, or nullptr.
+      static const char* prometheus_type() { return nullptr; }
+
+      // Format the samples of the metric family (complete lines) of the value with the metric name of size bytes.
+      static void prometheus_format(write_buffer& buf, const char* name, size_t size, const T& value) {}
+   };
+   template<typename T> struct value_traits : default_value_traits<T> {};
+   
+   //
+   // Number formatting without allocations or locale.
+   //
+
+   inline void format_uint(write_buffer& buf, uint64_t value)
+   {
+      char tmp[20];
+      char* end = tmp + sizeof(tmp);
+      char* p = end;
+      do {
+         *--p = char('0' + value % 10);
+         value /= 10;
+      } while (value);
+      buf.append(p, size_t(end - p));
+   }
+
+   inline void format_int(write_buffer& buf, int64_t value)
+   {
+      if (value < 0) {
+         buf.append('-');
+         format_uint(buf, 0 - uint64_t(value));
+      }
+      else {
+         format_uint(buf, uint64_t(value));
+      }
+   }
+
+   // Formats with 19 digits precision (same as an ostream with precision 19), integral values are formatted
+   // without going through printf.
+   inline void format_double(write_buffer& buf, double value)
+   {
+      if (std::isfinite(value) and std::abs(value) < 1e15 and value == std::trunc(value)) {
+         format_int(buf, int64_t(value));
+         return;
+      }
+      char tmp[32];
+      int len = snprintf(tmp, sizeof(tmp), "%.19g", value);
+      buf.append(tmp, size_t(std::max(0, std::min(len, int(sizeof(tmp)) - 1))));
+   }
+   
    //
    // JSON formatting.
    //
 
- 
+   //
+   // Escape chars that needs escaping (\, " and control chars) and append to buffer. Assuming string is already utf-8
+   // encoded, nothing more should be needed since json is encoded utf-8 by default.
+   //
+   inline void json_escape(write_buffer& buf, const char* str, size_t size)
+   {
+      static const char* hex = "0123456789abcdef";
+      const char* end = str + size;
+      while (str < end) {
+         // Append the longest run of chars that does not need escaping in one go.
+         auto run = str;
+         while (run < end and *run != '"' and *run != '\\' and uint8_t(*run) > 0x1f) ++run;
+         buf.append(str, size_t(run - str));
+         if (run == end) {
+            return;
+         }
+         char* p = buf.extend(6);
+         p[0] = '\\';
+         p[1] = 'u';
+         p[2] = '0';
+         p[3] = '0';
+         p[4] = hex[uint8_t(*run) >> 4];
+         p[5] = hex[uint8_t(*run) & 0xf];
+         str = run + 1;
+      }
+   }
+   inline void json_escape(write_buffer& buf, const std::string& str) { json_escape(buf, str.data(), str.size()); }
    
    //
    // Escape chars that needs escaping (\, " and control chars). Assuming string is already utf-8 encoded, nothing more
@@ -60,16 +253,9 @@ namespace glo {
    //
    inline std::string escape_json(const std::string& str)
    {
-      std::ostringstream ss;
-      for (auto c : str) {
-         if (c == '"' or c == '\\' or (0x00 <= c and c <= 0x1f)) {
-            ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << uint32_t(c);
-         }
-         else {
-            ss << c;
-         }
-      }
-      return ss.str();
+      write_buffer buf;
+      json_escape(buf, str);
+      return buf.str();
    }
 
    // TODO Change implementations to template specializations or does it really matter?
@@ -85,19 +271,89 @@ namespace glo {
    inline void json_format(std::ostream& os, const int32_t& value) { os << value; }
    inline void json_format(std::ostream& os, const int16_t& value) { json_format(os, int32_t(value)); }
    inline void json_format(std::ostream& os, const int8_t& value) { json_format(os, int32_t(value)); }
+   inline void json_format(std::ostream& os, const double& value) { os << std::setprecision(19) << value; }
+   inline void json_format(std::ostream& os, const float& value) { json_format(os, double(value)); }
    inline void json_format(std::ostream& os, const char& value) { os << '"' << value << '"'; }
    inline void json_format(std::ostream& os, const bool& value) { os << (value ? "true" : "false"); };
    
    template<typename V> void json_format(std::ostream& os, const V* value) { json_format(os, *value); }
    template<typename V> void json_format(std::ostream& os, const std::shared_ptr<V> value) { json_format(os, *value); }
    template<typename V> void json_format(std::ostream& os, const std::reference_wrapper<V>& value) { json_format(os, value.get()); }
+
+   // JSON formatting functions writing to a buffer, used on the hot path when reading values.
+   inline void json_format(write_buffer& buf, const char* value, size_t size)
+   {
+      buf.append('"');
+      json_escape(buf, value, size);
+      buf.append('"');
+   }
+   inline void json_format(write_buffer& buf, const std::string& value) { json_format(buf, value.data(), value.size()); }
+   inline void json_format(write_buffer& buf, const char* value) { json_format(buf, value, strlen(value)); }
+   inline void json_format(write_buffer& buf, const uint64_t& value) { format_uint(buf, value); }
+   inline void json_format(write_buffer& buf, const uint32_t& value) { format_uint(buf, value); }
+   inline void json_format(write_buffer& buf, const uint16_t& value) { format_uint(buf, value); }
+   inline void json_format(write_buffer& buf, const uint8_t& value) { format_uint(buf, value); }
+   inline void json_format(write_buffer& buf, const int64_t& value) { format_int(buf, value); }
+   inline void json_format(write_buffer& buf, const int32_t& value) { format_int(buf, value); }
+   inline void json_format(write_buffer& buf, const int16_t& value) { format_int(buf, value); }
+   inline void json_format(write_buffer& buf, const int8_t& value) { format_int(buf, value); }
+   inline void json_format(write_buffer& buf, const double& value) { format_double(buf, value); }
+   inline void json_format(write_buffer& buf, const float& value) { format_double(buf, value); }
+   inline void json_format(write_buffer& buf, const char& value) { json_format(buf, &value, 1); }
+   inline void json_format(write_buffer& buf, const bool& value) { buf.append(value ? "true" : "false"); };
+
+   // Format value into buffer using json_format for write_buffer if there is one for the type and json_format for
+   // std::ostream otherwise.
+   template<typename V>
+   auto json_format_any(write_buffer& buf, const V& value, int) -> decltype(json_format(buf, value))
+   {
+      json_format(buf, value);
+   }
+   template<typename V>
+   void json_format_any(write_buffer& buf, const V& value, long)
+   {
+      json_format(buf.stream(), value);
+   }
    
+   template<typename V> void json_format(write_buffer& buf, const V* value)
+   {
+      json_format_any(buf, *value, 0);
+   }
+   template<typename V> void json_format(write_buffer& buf, const std::shared_ptr<V> value)
+   {
+      json_format_any(buf, *value, 0);
+   }
+   template<typename V> void json_format(write_buffer& buf, const std::reference_wrapper<V>& value)
+   {
+      json_format_any(buf, value.get(), 0);
+   }
+
    // The default json formatter that just calls json_format for the type V.
    template<typename V> struct json_formatter
    {
       void operator()(std::ostream& os, const V& value) const { json_format(os, value); };
+      void operator()(write_buffer& buf, const V& value) const { json_format_any(buf, value, 0); };
    };
 
+   // Format value into buffer using formatter, using the buffer overload of the formatter if available and the
+   // std::ostream overload otherwise.
+   template<typename JsonFormatter, typename V>
+   auto format_with(const JsonFormatter& formatter, write_buffer& buf, const V& value, int)
+      -> decltype(formatter(buf, value))
+   {
+      formatter(buf, value);
+   }
+   template<typename JsonFormatter, typename V>
+   void format_with(const JsonFormatter& formatter, write_buffer& buf, const V& value, long)
+   {
+      formatter(buf.stream(), value);
+   }
+   template<typename JsonFormatter, typename V>
+   void format_with(const JsonFormatter& formatter, write_buffer& buf, const V& value)
+   {
+      format_with(formatter, buf, value, 0);
+   }
+   
    //
    // Utils.
    //
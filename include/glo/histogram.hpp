@@ -0,0 +1,225 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+
+#include <glo/common.hpp>
+
+
+namespace glo {
+
+   // Number of bits of sub buckets per power of two in a histogram, values are recorded with a relative error of at
+   // most 1 / 2^HISTOGRAM_SUB_BUCKET_BITS.
+   constexpr uint32_t HISTOGRAM_SUB_BUCKET_BITS = 5;
+   constexpr uint32_t HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+
+   // Total number of buckets in a histogram, enough to cover all uint64_t values.
+   constexpr uint32_t HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+   
+   //
+   // Histogram of uint64_t values (typically durations in ns) with log-linear buckets, values below
+   // HISTOGRAM_SUB_BUCKETS gets one bucket each and every power of two above that is split in HISTOGRAM_SUB_BUCKETS
+   // buckets. Uses 15 KiB of memory regardless of the number of recorded values.
+   //
+   // Recording is a relaxed add to the bucket and the sum, min and max are only written when a new min or max is
+   // recorded. Reading never blocks recorders, values recorded concurrently with a read may or may not be included.
+   //
+   // Can be added to a group by raw pointer, std::ref or std::shared_ptr, it will be read without locking the group
+   // mutex and it will be formatted as one item for each of count, min, max, mean, p50, p90, p99 and p999 all tagged
+   // tag::DURATION. In Prometheus format it is one histogram metric with cumulative buckets for every power of two
+   // (le 0, 1, 3, 7, ... 2^63 - 1 and +Inf), sum and count.
+   //
+   struct histogram
+   {
+      inline histogram();
+
+      histogram(const histogram&) = delete;
+      histogram& operator=(const histogram&) = delete;
+
+      // Record a value, callable from any thread.
+      inline void record(uint64_t value);
+
+      // Number of recorded values.
+      inline uint64_t count() const;
+
+      // Sum of recorded values.
+      uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+      
+      // Smallest recorded value, 0 if there are no values.
+      uint64_t min() const { auto min = _min.load(std::memory_order_relaxed); return min == NO_MIN ? 0 : min; }
+
+      // Largest recorded value, 0 if there are no values.
+      uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+
+      // Mean of recorded values, 0 if there are no values.
+      double mean() const { auto c = count(); return c ? double(sum()) / double(c) : 0; }
+
+      // Value at quantile q (0 - 1), reported as the highest value in the bucket but never more than max, 0 if there
+      // are no values.
+      inline uint64_t percentile(double q) const;
+      
+      // Bucket index of a value.
+      inline static uint32_t bucket_index(uint64_t value);
+
+      // Highest value in the bucket with index.
+      inline static uint64_t bucket_max(uint32_t index);
+
+      // Number of recorded values in the bucket with index.
+      uint64_t bucket_count(uint32_t index) const { return _buckets[index].load(std::memory_order_relaxed); }
+      
+   private:
+
+      static constexpr uint64_t NO_MIN = std::numeric_limits<uint64_t>::max();
+      
+      std::atomic<uint64_t> _sum{0};
+      std::atomic<uint64_t> _min{NO_MIN};
+      std::atomic<uint64_t> _max{0};
+      std::atomic<uint64_t> _buckets[HISTOGRAM_BUCKETS];
+   };
+
+   template<> struct value_traits<histogram> : default_value_traits<histogram>
+   {
+      static constexpr bool lock_free = true;
+      
+      static tags_t tags() { return {tag::DURATION}; }
+
+      static std::vector<std::pair<tag_t, void (*)(write_buffer&, const histogram&)>> items()
+      {
+         return {
+            {tag::COUNT, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.count()); }},
+            {tag::MIN, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.min()); }},
+            {tag::MAX, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.max()); }},
+            {tag::MEAN, [](write_buffer& buf, const histogram& h) { format_double(buf, h.mean()); }},
+            {tag::P50, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.percentile(0.5)); }},
+            {tag::P90, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.percentile(0.9)); }},
+            {tag::P99, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.percentile(0.99)); }},
+            {tag::P999, [](write_buffer& buf, const histogram& h) { format_uint(buf, h.percentile(0.999)); }},
+         };
+      }
+
+      static const char* prometheus_type() { return "histogram"; }
+
+      static void prometheus_format(write_buffer& buf, const char* name, size_t size, const histogram& h)
+      {
+         // Bucket boundaries at 2^k - 1 are bucket maxes, so the cumulative counts are exact. The count is the sum of
+         // the buckets to be the same as the +Inf bucket.
+         uint64_t count = 0;
+         uint32_t index = 0;
+         for (uint32_t k = 0; k < 64; ++k) {
+            uint64_t le = (uint64_t(1) << k) - 1;
+            for (auto last = histogram::bucket_index(le); index <= last; ++index) {
+               count += h.bucket_count(index);
+            }
+            buf.append(name, size);
+            buf.append("_bucket{le=\"");
+            format_uint(buf, le);
+            buf.append("\"} ");
+            format_uint(buf, count);
+            buf.append('\n');
+         }
+         for (; index < HISTOGRAM_BUCKETS; ++index) {
+            count += h.bucket_count(index);
+         }
+         buf.append(name, size);
+         buf.append("_bucket{le=\"+Inf\"} ");
+         format_uint(buf, count);
+         buf.append('\n');
+         buf.append(name, size);
+         buf.append("_sum ");
+         format_uint(buf, h.sum());
+         buf.append('\n');
+         buf.append(name, size);
+         buf.append("_count ");
+         format_uint(buf, count);
+         buf.append('\n');
+      }
+   };
+
+   // Format histogram as a json object with all items.
+   inline void json_format(write_buffer& buf, const histogram& value)
+   {
+      const char* delimiter = "{";
+      for (auto& item : value_traits<histogram>::items()) {
+         buf.append(delimiter);
+         json_format(buf, item.first);
+         buf.append(':');
+         item.second(buf, value);
+         delimiter = ",";
+      }
+      buf.append('}');
+   }
+   inline void json_format(std::ostream& os, const histogram& value)
+   {
+      write_buffer buf;
+      json_format(buf, value);
+      os.write(buf.data(), std::streamsize(buf.size()));
+   }
+   
+   //
+   // Implementation.
+   //
+
+   histogram::histogram()
+   {
+      for (auto& bucket : _buckets) {
+         bucket.store(0, std::memory_order_relaxed);
+      }
+   }
+
+   void histogram::record(uint64_t value)
+   {
+      _buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+      _sum.fetch_add(value, std::memory_order_relaxed);
+      auto min = _min.load(std::memory_order_relaxed);
+      while (value < min and not _min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {}
+      auto max = _max.load(std::memory_order_relaxed);
+      while (value > max and not _max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+   }
+
+   uint64_t histogram::count() const
+   {
+      uint64_t count = 0;
+      for (auto& bucket : _buckets) {
+         count += bucket.load(std::memory_order_relaxed);
+      }
+      return count;
+   }
+   
+   uint64_t histogram::percentile(double q) const
+   {
+      auto count = this->count();
+      if (count == 0) {
+         return 0;
+      }
+      auto rank = std::max(uint64_t(1), uint64_t(std::ceil(q * double(count))));
+      auto max = this->max();
+      uint64_t sum = 0;
+      for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+         sum += _buckets[i].load(std::memory_order_relaxed);
+         if (sum >= rank) {
+            return std::min(bucket_max(i), max);
+         }
+      }
+      return max;
+   }
+   
+   uint32_t histogram::bucket_index(uint64_t value)
+   {
+      if (value < HISTOGRAM_SUB_BUCKETS) {
+         return uint32_t(value);
+      }
+      uint32_t exponent = 63 - uint32_t(__builtin_clzll(value));
+      uint32_t sub_bucket = uint32_t(value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) - HISTOGRAM_SUB_BUCKETS;
+      return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+   }
+
+   uint64_t histogram::bucket_max(uint32_t index)
+   {
+      if (index < HISTOGRAM_SUB_BUCKETS) {
+         return index;
+      }
+      uint32_t shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+      uint64_t sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+      return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+   }
+}
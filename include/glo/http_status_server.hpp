@@ -1,14 +1,26 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <glo/common.hpp>
@@ -17,15 +29,46 @@
 namespace glo {
 
    using namespace std::literals::chrono_literals;
+
+   //
+   // Path of a unix domain socket for the status server to listen to, a path starting with @ is in the abstract
+   // namespace (the @ is replaced with a null byte), other paths are created in the file system and removed when the
+   // server is destructed.
+   //
+   struct unix_socket
+   {
+      explicit unix_socket(const std::string& path) : path(path) {}
+      std::string path;
+   };
    
    //
    // A class for servring status messages using a minimal HTTP (only 1.1 supported) server implementation (supports
-   // only GET and will close the connection after every request). The server will return the same response for all
-   // paths. All methods are thread safe.
+   // only GET). The server will return the items in the Prometheus text format for the path /metrics (see
+   // prometheus.hpp) and the same json response for all other paths. The compact binary format (see
+   // binary_format.hpp) is returned for format=binary or if the Accept header includes application/x-glo-binary, the
+   // schema is left out if the request has schema=<schema version> with the current version. All methods are thread
+   // safe.
+   //
+   // When serving forever connections are persistent (keep-alive) unless the client sends "Connection: close",
+   // pipelined requests are answered in order. Idle connections are closed after a while and the number of open
+   // connections is limited, idle connections will be closed to make room for new ones. When serving once the
+   // connection is always closed after the request.
+   //
+   // The server is driven by epoll, waiting in the kernel until a socket is ready or stop is called (which wakes the
+   // server through an eventfd), so an idle server does not wake up at all.
+   // The server can also be driven by an event loop of the application with no thread of its own, see embed.
+   //
+   // The server listens to a TCP port, a unix domain socket (see unix_socket) or both, for local collectors a unix
+   // domain socket avoids the TCP stack and can be protected with file permissions.
    //
-   // It is important that the server is not accessed to often because each request will possible lock mutexes shared
-   // with the actual business logic. Therefore the server is throttled by sleeping 50 ms after each request. This is
-   // configurable.
+   // Connections are multiplexed, each connection is reading or writing independently with its own deadline, so a
+   // slow client will not stall other clients.
+   //
+   // It is important that the values are not read to often because each read will possible lock mutexes shared with
+   // the actual business logic. Therefore the formatted values are cached as a snapshot that is reused by all
+   // requests until it is older than max age (50 ms by default, configurable). Only one snapshot is formatted at a
+   // time, threads needing a new snapshot while one is formatted will wait for that one and use it. For very large
+   // groups responses can instead be streamed in chunks with bounded memory, see set_streaming.
    //
    // It is possible to get the reposnse in two formats (controlled by HTTP query parameters):
    //
@@ -33,6 +76,18 @@ namespace glo {
    //
    // a jsonp callback as application/javascript: by adding callback=<javascript function name> as a request parameter
    //
+   // The items can also be filtered with the request parameters level=<max level>, prefix=<key prefix> and
+   // tag=<tag>. The filter is applied when reading values, so groups that can not match are not locked at all.
+   //
+   // Json responses to requests with since=<generation> (or If-None-Match: "<generation>") have a generation (also as
+   // ETag), changed when any item is changed, added or removed. They get 304 Not Modified if nothing changed since
+   // the generation, otherwise only the items changed after that generation and "removed" with keys of removed items
+   // (newest first). If the generation is not known (like since=0 to start) all items are returned. Changes are only
+   // tracked for filters that such requests are made for, other responses have no generation.
+   //
+   // With a sampler started (see start_sampler) history=<seconds> returns the recent samples of the sampled items at
+   // a higher rate than requests are made.
+   //
    struct http_status_server : public group
    {
       // Create the server, which is also a group. For parameters key_prefix and mutexe see group doc. Set the port the
@@ -45,57 +100,409 @@ namespace glo {
       http_status_server(std::string key_prefix, std::shared_ptr<std::mutex> mutex, uint16_t port)
          : group(key_prefix, mutex), _port(port) { bind(); }
 
+      // Create the server listening only to a unix domain socket instead of a TCP port. Throws glo::os_error on failed
+      // system calls or if the path is in use.
+      http_status_server(const unix_socket& unix) { bind(unix); }
+      http_status_server(std::string key_prefix, const unix_socket& unix) : group(key_prefix) { bind(unix); }
+      http_status_server(std::shared_ptr<std::mutex> mutex, const unix_socket& unix) : group(mutex) { bind(unix); }
+      http_status_server(std::string key_prefix, std::shared_ptr<std::mutex> mutex, const unix_socket& unix)
+         : group(key_prefix, mutex) { bind(unix); }
+
       http_status_server(const http_status_server&) = delete;
       http_status_server& operator=(const http_status_server&) = delete;
       
-      // Get the actual port used if not manually set, returns 0 if failed to bind on (any) port.
+      // Get the actual port used if not manually set, returns 0 if failed to bind on (any) port or if only listening
+      // to a unix domain socket.
       inline uint16_t port();
+
+      // Also listen to a unix domain socket, requests are handled the same way as on the TCP port. Only one unix domain
+      // socket can be used. Can be called while serving, the serving thread is woken up to start listening to it. When
+      // embedded it must be called from the thread driving the server. Throws glo::os_error on failed system calls or
+      // if the path is in use.
+      inline void listen_unix(const unix_socket& unix);
       
-      // Serves one request and returns or returns if no one connected after about timeout time has passed or returns an
-      // unspecified time after stop is called. Throws glo::os_error on failed system calls. Returns false is there was
+      // Serves one request and returns or returns if no one connected after about timeout time has passed or returns
+      // promptly after stop is called. Throws glo::os_error on failed system calls. Returns false is there was
       // a timeout or if stop was called and true otherwise, note that true does not mean that a request was fully
       // completed if request max time was reached before completing it will return true.
       template<typename Rep, typename Period>
       bool serve_once(const std::chrono::duration<Rep, Period>& timeout);
       bool serve_once() { return serve_once(std::chrono::seconds(0)); };
       
-      // Serve requests forever. Only returning an unspecified time after stop is called. Sleep sleep_time seconds
-      // between each request, this works as a throttling mechanism. Throws glo::os_error on failed system calls.
+      // Serve requests forever. Only returning promptly after stop is called. Reuse the formatted snapshot of values
+      // for all requests until it is older than max_age. Throws glo::os_error on failed system calls.
       template<typename Rep, typename Period>
-      void serve_forever(const std::chrono::duration<Rep, Period>& sleep_time);
+      void serve_forever(const std::chrono::duration<Rep, Period>& max_age);
       void serve_forever() { serve_forever(50ms); };
       
       // Start a new thread responding to requests (calls serve_forever). The thread will be stopped and joined if stop
       // is called. If a non stopped server is destructed the process will terminate. Throws glo::os_error on failed
       // system calls.
       template<typename Rep, typename Period>
-      void start(const std::chrono::duration<Rep, Period>& sleep_time);
+      void start(const std::chrono::duration<Rep, Period>& max_age);
       void start() { start(50ms); };
       
       // Stop serving. If a thread was started with start it will block until the thread is stopped, otherwise it will
       // return immediately.
       inline void stop();
 
-      // TODO Add status_server glo statistics, meta!
+      // Stream responses as chunks (chunked transfer encoding) instead of formatting and caching a full snapshot. The
+      // items are formatted group by group, a chunk is sent when it is at least chunk_size large, so memory used per
+      // response is bounded by chunk_size plus the largest group. Streamed responses are always read when requested,
+      // max age is not used. Call with 0 to turn streaming off.
+      inline void set_streaming(size_t chunk_size = 64 * 1024);
+
+      // Add statistics about the server itself as items with keys starting with key_prefix: requests served, bytes
+      // sent, timeouts, errors, time formatting snapshots, number of items in the last snapshot, process wide lock
+      // statistics (see lock_stats) and callback statistics (see callback_stats). The statistics are always collected
+      // but only served after calling this.
+      inline void add_statistics(const std::string& key_prefix = "/glo/server");
 
-      virtual ~http_status_server() { if (_socket != -1) close(_socket); }
+      // Start a thread sampling the values of the items matching filter every interval, keeping the last samples
+      // samples of each item in a ring buffer. A request with history=<seconds> gets the samples from the last seconds
+      // as one array of timestamps and one array of values per item (null if it could not be read). Values are read
+      // as in the binary format, so only numbers and booleans have values. The history is allocated up front and
+      // again only when items are added or removed, sampling does not allocate. Does nothing if already started.
+      template<typename Rep, typename Period>
+      void start_sampler(const std::chrono::duration<Rep, Period>& interval, size_t samples,
+                         const glo::filter& filter = glo::filter());
+
+      // Stop the sampler thread if started, the history is kept.
+      inline void stop_sampler();
+
+      // Called with an fd and the events (EPOLLIN or EPOLLOUT) to wait for on it, see embed.
+      using interest_callback = std::function<void(int fd, uint32_t events)>;
+
+      // Let an application event loop drive the server instead of calling serve_once, serve_forever or start. The
+      // callback is called with every fd the server needs to wait for and the events to wait for (level triggered)
+      // whenever that changes, and with events 0 when the fd should not be waited for any more (it is about to be
+      // closed or the server is not accepting connections right now). It is called for the listening sockets before
+      // embed returns. Then call on_ready when an fd is ready and on_deadline when next_deadline has passed, these
+      // never block and must be called from the same thread as the callback is called from (except for the first
+      // calls from embed). Snapshots are reused until older than max_age, as in serve_forever.
+      template<typename Rep, typename Period>
+      void embed(interest_callback callback, const std::chrono::duration<Rep, Period>& max_age);
+      void embed(interest_callback callback) { embed(callback, 50ms); }
+
+      // Handle events (EPOLL* flags) ready on fd, never blocks. Throws glo::os_error on failed system calls.
+      inline void on_ready(int fd, uint32_t events);
+
+      // Close connections that passed their deadline.
+      inline void on_deadline();
+
+      // Time when on_deadline should be called, time point max if no connection is open.
+      inline std::chrono::steady_clock::time_point next_deadline();
+      
+      virtual ~http_status_server()
+      {
+         stop_sampler();
+         close_connections();
+         for (auto sock : {_socket, _unix_socket}) {
+            if (sock != -1 and _interest_callback) _interest_callback(sock, 0);
+         }
+         if (_socket != -1) close(_socket);
+         if (_unix_socket != -1) close(_unix_socket);
+         if (_pending_unix_socket != -1) close(_pending_unix_socket);
+         if (not _unix_path.empty() and _unix_path[0] != '@') unlink(_unix_path.c_str());
+         if (_epoll != -1) close(_epoll);
+         if (_wakeup != -1) close(_wakeup);
+      }
       
    private:
 
+      using clock = std::chrono::steady_clock;
+      
+      // Create epoll and wakeup, then bind to the TCP port or the unix domain socket.
       inline void bind();
+      inline void bind(const unix_socket& unix);
+      inline void bind_events();
+
+      // Create a unix domain socket listening to path, returns the socket.
+      inline int bind_unix(const unix_socket& unix);
+
+      // Start listening to the socket from listen_unix if there is one, called by the serving thread.
+      inline void add_pending_unix_socket();
+
+      // Wake up the serving thread if waiting for events.
+      inline void wake_up();
+      
+      // Start or stop waiting for new connections on the listening sockets.
+      inline void set_accepting(bool accepting);
+
+      // A response in up to three segments sent with one sendmsg: head (status line, headers and jsonp prefix),
+      // body (a shared snapshot from body offset, never copied) and tail (jsonp suffix).
+      struct response
+      {
+         write_buffer head;
+         std::shared_ptr<const write_buffer> body;
+         size_t body_offset{0};
+         const char* tail{""};
+         size_t tail_size{0};
 
-      inline bool internal_serve_once(const std::chrono::microseconds& accept_timeout,
-                                      const std::chrono::microseconds& poll_wait);
+         size_t size() const { return head.size() + (body ? body->size() - body_offset : 0) + tail_size; }
+
+         // Fill iov with the segments remaining after offset bytes, returns the number of iovecs used (at most 3).
+         inline int iovecs(size_t offset, iovec* iov) const;
+         
+         inline void clear();
+      };
       
-      inline bool handle_request(int server, const std::chrono::microseconds& poll_wait);
+      // State of a response streamed in chunks, see set_streaming.
+      struct stream_state
+      {
+         bool active{false};
+         glo::filter filter;
+         std::string cb;
+         size_t position{0};
+         const char* delimiter{""};
+         size_t items{0};
+         std::shared_ptr<write_buffer> chunk;
+      };
+      
+      // State for one client connection. A connection is first reading a request, then writing the response. After
+      // that it goes back to reading or directly to writing the next response if there already is a pipelined request
+      // in the input.
+      struct connection
+      {
+         enum state_t { READING, WRITING };
          
-      inline std::string do_http(std::stringstream& request);
+         int fd{-1};
+         state_t state{READING};
+         uint32_t events{0};
+         clock::time_point timeout_time;
+         std::string in;
+         response out;
+         size_t sent{0};
+         bool close{false};
+         stream_state stream;
+      };
+      
+      // Wait for events until timeout_time, then handle all ready sockets. Returns number of connections finished
+      // (closed).
+      inline uint32_t serve_events(const clock::time_point& timeout_time);
+
+      // Handle the ready fd (listening socket or connection). Returns number of connections finished (closed).
+      inline uint32_t handle_ready(int fd);
+
+      // Close connections that passed their deadline. Returns number of connections closed.
+      inline uint32_t close_timed_out();
+      
+      // Accept all pending connections on the listening socket.
+      inline void accept_connections(int socket);
+
+      // Read or write as much as possible on the connection. Returns false if the connection is finished and should
+      // be closed.
+      inline bool handle_connection(connection& conn);
+
+      // Change state of connection to reading or writing, waiting for the socket to be ready.
+      inline void set_state(connection& conn, connection::state_t state);
+      
+      // Format the response for the first completely read request.
+      inline void respond(connection& conn);
+
+      // Close an idle connection to make room for a new one, returns false if there was none.
+      inline bool evict_idle_connection();
+      
+      inline void close_connection(int fd);
+      
+      inline void close_connections();
+      
+      // Parse request and write the response to out. Keep alive is set to false if the connection should be closed.
+      // If streaming, out is the first chunk and stream is started.
+      inline void do_http(const char* request, size_t size, bool& keep_alive, response& out, stream_state& stream);
+
+      // Format the next chunk of a streamed response after what is already in the stream chunk buffer, write it to
+      // out. The stream is no longer active when the last chunk is written.
+      inline void stream_chunk(response& out, stream_state& stream);
+
+   protected:
+
+      // Change tracking of the items in a json snapshot, for delta responses. Items are identified by a hash of the key
+      // and compared by a hash of the whole item. Generations are ordered and unique for the server (they start from
+      // the time the server was created to not repeat after a restart).
+      struct delta_state
+      {
+         struct entry
+         {
+            uint64_t key_hash;
+            uint64_t hash;
+
+            // Generation when the item was added or last changed.
+            uint64_t changed;
+
+            // Range of the item in the snapshot and range of the (escaped) key in keys.
+            size_t begin;
+            size_t end;
+            size_t key_begin;
+            size_t key_end;
+         };
+
+         // Generation of the snapshot, only changed if any item changed, was added or was removed.
+         uint64_t generation{0};
+
+         // Oldest generation a delta can be made from.
+         uint64_t first{0};
+
+         // Items in snapshot order.
+         std::vector<entry> entries;
+
+         // A removed item, linked to the one removed before it so states can share them.
+         struct removed_key
+         {
+            uint64_t generation;
+            uint64_t key_hash;
+            std::string key;
+            std::shared_ptr<const removed_key> older;
+         };
+
+         // Keys of the items, shared with the previous state if the items are the same.
+         std::shared_ptr<const std::string> keys;
+
+         // Removed items (newest first) and the number of them, shared with the previous state.
+         std::shared_ptr<const removed_key> removed;
+         size_t removed_count{0};
+      };
+      
+      // Track changes of the json items in content (starting at item_begins, the last one ending at items_end)
+      // compared to previous.
+      inline std::shared_ptr<const delta_state> track_changes(const write_buffer& content,
+                                                              const std::vector<size_t>& item_begins, size_t items_end,
+                                                              const std::shared_ptr<const delta_state>& previous);
+
+      // Copy at most limit of the removed keys from removed (newest first), leaving out keys with hashes in
+      // skip_hashes. Returns the copy, count is set to the number of copied keys.
+      inline static std::shared_ptr<const delta_state::removed_key>
+      copy_removed(const std::shared_ptr<const delta_state::removed_key>& removed,
+                   const std::vector<uint64_t>& skip_hashes, size_t limit, size_t& count);
+
+   private:
+
+      // Get the formatted json object (or Prometheus text or binary) with all items matching filter, reusing the last
+      // snapshot for the same filter and format if it is not older than max_age. If delta is not null changes are
+      // tracked (json only, in snapshots separate from the ones without tracking) and it is set to the change tracking
+      // of the snapshot.
+      inline std::shared_ptr<const write_buffer> snapshot(const clock::duration& max_age, const filter& filter,
+                                                          format_t format,
+                                                          std::shared_ptr<const delta_state>* delta = nullptr);
+
+
+      // Register, modify or remove (op is one of EPOLL_CTL_*) events to wait for on fd in the internal epoll instance,
+      // or only tell the interest callback if embedded.
+      inline void set_interest(int op, int fd, uint32_t events);
 
+      // Close the connection socket, telling the interest callback first if embedded.
+      inline void close_socket(int fd);
+
+      // Write a 400 response with message to out.
+      inline void error_response(write_buffer& out, const char* message);
+
+      // Sample values into the history every interval until the sampler is stopped.
+      inline void sample(clock::duration interval, size_t samples, const glo::filter& filter);
+
+      // Format the samples from the last seconds of the history as a json object into body.
+      inline void format_history(write_buffer& body, double seconds);
+      
       int _socket{-1};
+      // Listening unix domain socket, only used by the serving thread once serving. A socket from listen_unix is
+      // pending until the serving thread adds it, the pending socket and the path are protected by the mutex.
+      int _unix_socket{-1};
+      int _pending_unix_socket{-1};
+      std::string _unix_path;
+      int _epoll{-1};
+      int _wakeup{-1};
       uint16_t _port{0};
       std::unique_ptr<std::thread> _server_thread;
       std::atomic<bool> _stop{false};
 
+      // Set when embedded, see embed.
+      interest_callback _interest_callback;
+
+      // Connections by fd, only accessed by the serving thread.
+      std::map<int, connection> _connections;
+      
+      // Max age of snapshot when responding to requests.
+      clock::duration _max_age{0};
+
+      // Chunk size when streaming responses, 0 when not streaming.
+      std::atomic<size_t> _stream_chunk_size{0};
+      
+      // Keep connections open between requests.
+      bool _keep_alive{false};
+
+      // If the listening socket is in the epoll set, false when max connections is reached.
+      bool _accepting{true};
+
+      // A formatted snapshot and the time formatting was started.
+      struct cached_snapshot
+      {
+         std::shared_ptr<const write_buffer> content;
+         std::shared_ptr<const delta_state> delta;
+         clock::time_point time;
+      };
+      
+      // Last formatted snapshots by filter and if one is being formatted, protected by snapshot mutex.
+      std::mutex _snapshot_mutex;
+      std::condition_variable _snapshot_done;
+      std::map<std::string, cached_snapshot> _snapshots;
+      bool _snapshot_running{false};
+
+      // Buffer for formatting binary snapshots before the header, positions of items in json snapshots and the last
+      // generation used, only used by the thread formatting a snapshot.
+      write_buffer _binary_body;
+      std::vector<size_t> _item_begins;
+
+      // A replaced delta state to reuse the storage of when no one else uses it, set with the snapshot mutex locked
+      // and used by the thread formatting a snapshot.
+      std::shared_ptr<delta_state> _spare_delta;
+      uint64_t _generation{uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::system_clock::now().time_since_epoch()).count())};
+
+      // Buffer for delta and history responses, only used by the serving thread.
+      write_buffer _delta_body;
+
+      // Sampled values, see start_sampler. Item i has its samples in types and values from i * capacity, next is the
+      // slot for the next sample (the oldest if count is capacity). Protected by the history mutex.
+      struct history
+      {
+         std::vector<binary_item> items;
+         uint64_t schema_version{0};
+         double interval{0};
+         size_t capacity{0};
+         size_t count{0};
+         size_t next{0};
+         std::vector<double> timestamps;
+         std::vector<binary_type_t> types;
+         std::vector<uint64_t> values;
+      };
+      std::mutex _history_mutex;
+      history _history;
+
+      // Samples and item heads (with the end of each head) copied from the history when formatting, to not hold the
+      // history mutex while formatting values. Only used by the serving thread.
+      std::vector<double> _history_timestamps;
+      std::vector<binary_type_t> _history_types;
+      std::vector<uint64_t> _history_values;
+      write_buffer _history_heads;
+      std::vector<size_t> _history_head_ends;
+      
+      // Sampler thread, protected by the sampler mutex.
+      std::mutex _sampler_mutex;
+      std::condition_variable _sampler_stopped;
+      bool _sampler_stop{false};
+      std::unique_ptr<std::thread> _sampler_thread;
+
+      // Statistics about the server, see add_statistics. Counters are only updated by the serving thread but may be
+      // read by any thread.
+      struct statistics
+      {
+         std::atomic<uint64_t> requests{0};
+         std::atomic<uint64_t> bytes_sent{0};
+         std::atomic<uint64_t> timeouts{0};
+         std::atomic<uint64_t> errors{0};
+         std::atomic<uint64_t> items{0};
+         histogram format_time;
+      };
+      statistics _stats;
    };
 
    //
@@ -104,9 +511,25 @@ namespace glo {
 
    // If a request is not completed completed within this time it will be closed.
    constexpr auto REQUEST_MAX_TIME = 2s;
-      
-   // Min time to wait between polling.
-   constexpr auto MIN_POLL_WAIT = 200us;
+
+   // If a request is larger than this the connection will be closed.
+   constexpr size_t REQUEST_MAX_SIZE = 16 * 1024;
+
+   // Keep-alive connections not starting a new request within this time will be closed.
+   constexpr auto KEEP_ALIVE_MAX_IDLE_TIME = 10s;
+
+   // Max number of open connections.
+   constexpr size_t CONNECTIONS_MAX = 64;
+
+   // Max number of cached snapshots (one per used filter).
+   constexpr size_t SNAPSHOTS_MAX = 16;
+   
+   // Max number of events to handle for every epoll wait.
+   constexpr int EPOLL_MAX_EVENTS = 64;
+
+   // Number of removed keys remembered for delta responses (per filter), up to twice as many are kept between
+   // dropping the oldest.
+   constexpr size_t DELTA_REMOVED_MAX = 1024;
    
    inline void set_non_blocking(int sock)
    {
@@ -120,8 +543,10 @@ namespace glo {
    void http_status_server::bind()
    {
       std::lock_guard<std::mutex> lock(_mutex);
+
+      bind_events();
       
-      _socket = socket(AF_INET6, SOCK_STREAM, 0);
+      _socket = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
       if (_socket == -1) {
          throw os_error("failed to create socket");
       }
@@ -164,8 +589,157 @@ namespace glo {
       if (listen(_socket, 32) == -1) {
          throw os_error("could not listen to socket");
       }
+
+      set_interest(EPOLL_CTL_ADD, _socket, _accepting ? EPOLLIN : 0);
+   }
+
+   void http_status_server::bind(const unix_socket& unix)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      bind_events();
+      _unix_socket = bind_unix(unix);
+      _unix_path = unix.path;
+      set_interest(EPOLL_CTL_ADD, _unix_socket, _accepting ? EPOLLIN : 0);
+   }
+
+   void http_status_server::listen_unix(const unix_socket& unix)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (not _unix_path.empty()) {
+         throw os_error("already listening to a unix domain socket");
+      }
+      auto sock = bind_unix(unix);
+      _unix_path = unix.path;
+      if (_interest_callback) {
+         // Embedded, this is the thread driving the server.
+         _unix_socket = sock;
+         set_interest(EPOLL_CTL_ADD, sock, _accepting ? EPOLLIN : 0);
+         return;
+      }
+
+      // Only the serving thread touches the listening sockets and the accepting state, let it add the socket.
+      _pending_unix_socket = sock;
+      wake_up();
+   }
+
+   void http_status_server::add_pending_unix_socket()
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_pending_unix_socket != -1) {
+         _unix_socket = _pending_unix_socket;
+         _pending_unix_socket = -1;
+         set_interest(EPOLL_CTL_ADD, _unix_socket, _accepting ? EPOLLIN : 0);
+      }
+   }
+
+   void http_status_server::wake_up()
+   {
+      uint64_t one = 1;
+      if (write(_wakeup, &one, sizeof(one)) == -1 and errno != EAGAIN) {
+         throw os_error("failed to wake up server");
+      }
    }
    
+   void http_status_server::bind_events()
+   {
+      _epoll = epoll_create1(EPOLL_CLOEXEC);
+      if (_epoll == -1) {
+         throw os_error("failed to create epoll instance");
+      }
+
+      _wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (_wakeup == -1) {
+         throw os_error("failed to create eventfd");
+      }
+      
+      set_interest(EPOLL_CTL_ADD, _wakeup, EPOLLIN);
+   }
+
+   int http_status_server::bind_unix(const unix_socket& unix)
+   {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (unix.path.empty() or unix.path.size() >= sizeof(addr.sun_path)) {
+         throw os_error("bad unix domain socket path '" + unix.path + "'");
+      }
+      memcpy(addr.sun_path, unix.path.data(), unix.path.size());
+      bool abstract = unix.path[0] == '@';
+      if (abstract) {
+         addr.sun_path[0] = '\0';
+      }
+      auto addr_size = socklen_t(offsetof(sockaddr_un, sun_path) + unix.path.size() + (abstract ? 0 : 1));
+      
+      int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (sock == -1) {
+         throw os_error("failed to create unix domain socket");
+      }
+      close_guard guard(sock);
+      
+      set_non_blocking(sock);
+
+      if (::bind(sock, (sockaddr*) &addr, addr_size) == -1) {
+         if (errno != EADDRINUSE or abstract) {
+            throw os_error("could not bind unix domain socket '" + unix.path + "'");
+         }
+         
+         // Remove the file if it is a socket that no one listens to (left by a process that did not exit cleanly).
+         struct stat st;
+         int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+         close_guard probe_guard(probe);
+         if (stat(unix.path.c_str(), &st) == -1 or not S_ISSOCK(st.st_mode) or probe == -1
+             or connect(probe, (sockaddr*) &addr, addr_size) == 0 or errno != ECONNREFUSED) {
+            throw os_error("unix domain socket '" + unix.path + "' is in use");
+         }
+         unlink(unix.path.c_str());
+         if (::bind(sock, (sockaddr*) &addr, addr_size) == -1) {
+            throw os_error("could not bind unix domain socket '" + unix.path + "'");
+         }
+      }
+      
+      if (listen(sock, 32) == -1) {
+         throw os_error("could not listen to unix domain socket");
+      }
+      
+      guard.fd = -1;
+      return sock;
+   }
+
+   void http_status_server::set_accepting(bool accepting)
+   {
+      for (auto sock : {_socket, _unix_socket}) {
+         if (sock != -1) {
+            set_interest(EPOLL_CTL_MOD, sock, accepting ? EPOLLIN : 0);
+         }
+      }
+      _accepting = accepting;
+   }
+
+   void http_status_server::set_interest(int op, int fd, uint32_t events)
+   {
+      if (_interest_callback) {
+         // Embedded, only the host waits for the socket.
+         _interest_callback(fd, op == EPOLL_CTL_DEL ? 0 : events);
+         return;
+      }
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = events;
+      event.data.fd = fd;
+      if (epoll_ctl(_epoll, op, fd, &event) == -1) {
+         throw os_error("failed to update epoll interest");
+      }
+   }
+
+   void http_status_server::close_socket(int fd)
+   {
+      if (_interest_callback) {
+         _interest_callback(fd, 0);
+      }
+      // Closing the socket will remove it from the epoll set (if not embedded).
+      close(fd);
+   }
+
    in_port_t http_status_server::port()
    {
       std::lock_guard<std::mutex> lock(_mutex);
@@ -173,214 +747,1224 @@ namespace glo {
    }
 
    template<typename Rep, typename Period>
-   void http_status_server::serve_forever(const std::chrono::duration<Rep, Period>& sleep_time)
+   void http_status_server::serve_forever(const std::chrono::duration<Rep, Period>& max_age)
    {
-      auto poll_wait = std::max(MIN_POLL_WAIT, std::chrono::duration_cast<std::chrono::microseconds>(sleep_time) / 10);
-      auto accept_timeout = 24h;
-      
+      _max_age = std::chrono::duration_cast<clock::duration>(max_age);
+      _keep_alive = true;
       while (not _stop) {
-         if (internal_serve_once(accept_timeout, poll_wait)) {
-            std::this_thread::sleep_for(sleep_time);
-         }
+         serve_events(clock::time_point::max());
       }
+      close_connections();
    }
 
    template<typename Rep, typename Period>
    bool http_status_server::serve_once(const std::chrono::duration<Rep, Period>& timeout)
    {
-      return internal_serve_once(std::chrono::duration_cast<std::chrono::microseconds>(timeout), MIN_POLL_WAIT);
+      _max_age = clock::duration::zero();
+      _keep_alive = false;
+      auto timeout_time = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+      while (true) {
+         if (_stop) {
+            close_connections();
+            return false;
+         }
+         
+         if (serve_events(timeout_time)) {
+            return true;
+         }
+         
+         if (_connections.empty() and clock::now() >= timeout_time) {
+            return false;
+         }
+      }
    }
 
-   bool http_status_server::internal_serve_once(const std::chrono::microseconds& accept_timeout,
-                                                const std::chrono::microseconds& poll_wait)
+   // Returns the position after the end of the first complete request in data or npos if there is none.
+   inline size_t find_request_end(const std::string& data, size_t search_pos = 0)
+   {
+      auto pos = data.find("\r\n\r\n", search_pos);
+      return pos == std::string::npos ? pos : pos + 4;
+   }
+   
+   uint32_t http_status_server::serve_events(const clock::time_point& timeout_time)
    {
-      auto accept_timeout_time = std::chrono::high_resolution_clock::now() + accept_timeout;
+      // Find out how long to wait, never longer than to the first connection deadline.
+      
+      auto wait_time = std::min(timeout_time, next_deadline());
+      
+      int timeout_ms = -1;
+      if (wait_time != clock::time_point::max()) {
+         auto now = clock::now();
+         // Round up, epoll has millisecond resolution and returning early would just cause another wait.
+         if (wait_time > now) {
+            timeout_ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(wait_time - now + 999us).count());
+         }
+         else {
+            timeout_ms = 0;
+         }
+      }
 
-      int server = -1;
-      while (true) {
-         if (_stop) return false;
+      epoll_event events[EPOLL_MAX_EVENTS];
+      int count = epoll_wait(_epoll, events, EPOLL_MAX_EVENTS, timeout_ms);
+      if (count == -1) {
+         if (errno == EINTR) return 0;
+         throw os_error("failed to wait for epoll events");
+      }
+      
+      uint32_t finished = 0;
+      
+      for (int i = 0; i < count; ++i) {
+         int fd = events[i].data.fd;
+         if (fd == _wakeup) {
+            // Reset the eventfd, stop is checked after serving events so a wake up from it is not lost.
+            uint64_t value;
+            if (read(_wakeup, &value, sizeof(value)) == -1 and errno != EAGAIN) {
+               throw os_error("failed to read eventfd");
+            }
+            add_pending_unix_socket();
+         }
+         else {
+            finished += handle_ready(fd);
+         }
+      }
+
+      return finished + close_timed_out();
+   }
+
+   uint32_t http_status_server::handle_ready(int fd)
+   {
+      if (fd == _socket or fd == _unix_socket) {
+         accept_connections(fd);
+         return 0;
+      }
          
-         server = accept(_socket, NULL, NULL);
+      auto it = _connections.find(fd);
+      if (it != _connections.end() and not handle_connection(it->second)) {
+         close_connection(fd);
+         return 1;
+      }
+      return 0;
+   }
 
-         if (server != -1) {
-            break;
+   uint32_t http_status_server::close_timed_out()
+   {
+      auto now = clock::now();
+      std::vector<int> timed_out;
+      for (auto& p : _connections) {
+         if (p.second.timeout_time <= now) {
+            timed_out.push_back(p.first);
          }
-         
-         if (errno == EAGAIN) {
-            if (std::chrono::high_resolution_clock::now() > accept_timeout_time) {
-               return false;
-            }
-            std::this_thread::sleep_for(poll_wait);
-            continue;
+      }
+      for (auto fd : timed_out) {
+         close_connection(fd);
+         _stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+      }
+      return uint32_t(timed_out.size());
+   }
+
+   template<typename Rep, typename Period>
+   void http_status_server::embed(interest_callback callback, const std::chrono::duration<Rep, Period>& max_age)
+   {
+      _max_age = std::chrono::duration_cast<clock::duration>(max_age);
+      _keep_alive = true;
+      add_pending_unix_socket();
+      _interest_callback = callback;
+      // The host waits for the sockets, the internal epoll instance is not used anymore.
+      if (_epoll != -1) {
+         close(_epoll);
+         _epoll = -1;
+      }
+      for (auto sock : {_socket, _unix_socket}) {
+         if (sock != -1) {
+            _interest_callback(sock, _accepting ? EPOLLIN : 0);
          }
-         
-         throw std::runtime_error("error accepting connection");
       }
-         
-      return handle_request(server, poll_wait);
+   }
+
+   void http_status_server::on_ready(int fd, uint32_t events)
+   {
+      // Ignore events not waited for (like a stale event for a socket that changed state).
+      auto it = _connections.find(fd);
+      if (it != _connections.end() and not (events & (it->second.events | EPOLLERR | EPOLLHUP))) {
+         return;
+      }
+      handle_ready(fd);
+   }
+
+   void http_status_server::on_deadline()
+   {
+      close_timed_out();
    }
    
-   bool http_status_server::handle_request(int server, const std::chrono::microseconds& poll_wait)
+   std::chrono::steady_clock::time_point http_status_server::next_deadline()
    {
-      char buf[2048];
-      
-      close_guard server_close(server);
-  
-      auto request_timeout_time = std::chrono::high_resolution_clock::now() + REQUEST_MAX_TIME;
-            
-      set_non_blocking(server);
+      auto deadline = clock::time_point::max();
+      for (auto& p : _connections) {
+         deadline = std::min(deadline, p.second.timeout_time);
+      }
+      return deadline;
+   }
 
-      // Read request.
-      std::stringstream data;
+   void http_status_server::accept_connections(int socket)
+   {
       while (true) {
-         if (_stop) return false;
+         if (_connections.size() >= CONNECTIONS_MAX and not evict_idle_connection()) {
+            // Stop accepting until a connection is closed.
+            set_accepting(false);
+            return;
+         }
          
-         auto received = recv(server, buf, sizeof(buf), 0);
-         if (received == -1) {
-            if (errno == EAGAIN) {
-               if (std::chrono::high_resolution_clock::now() > request_timeout_time) {
-                  // Request max time reached.
+         int fd = accept4(socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+         if (fd == -1) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+               return;
+            }
+            if (errno == EINTR or errno == ECONNABORTED) {
+               continue;
+            }
+            throw os_error("error accepting connection");
+         }
+
+         close_guard guard(fd);
+         set_interest(EPOLL_CTL_ADD, fd, EPOLLIN);
+         auto& conn = _connections[fd];
+         guard.fd = -1;
+         conn.fd = fd;
+         conn.events = EPOLLIN;
+         conn.timeout_time = clock::now() + REQUEST_MAX_TIME;
+      }
+   }
+
+   bool http_status_server::handle_connection(connection& conn)
+   {
+      while (true) {
+         if (conn.state == connection::READING) {
+            char buf[2048];
+            while (true) {
+               auto received = recv(conn.fd, buf, sizeof(buf), 0);
+               if (received == -1) {
+                  if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                     break;
+                  }
+                  if (errno == EINTR) {
+                     continue;
+                  }
+                  // Failed to receive data, close connection.
+                  _stats.errors.fetch_add(1, std::memory_order_relaxed);
+                  return false;
+               }
+            
+               if (received == 0) {
+                  // Client closed its end, answer what is already received (if anything) and then close.
+                  conn.close = true;
+                  break;
+               }
+
+               if (conn.in.empty()) {
+                  // A new request is started, it needs to be completed in time.
+                  conn.timeout_time = clock::now() + REQUEST_MAX_TIME;
+               }
+               conn.in.append(buf, size_t(received));
+            
+               if (conn.in.size() > REQUEST_MAX_SIZE) {
+                  _stats.errors.fetch_add(1, std::memory_order_relaxed);
+                  return false;
+               }
+            }
+
+            if (find_request_end(conn.in) == std::string::npos) {
+               set_state(conn, connection::READING);
+               return not conn.close;
+            }
+
+            respond(conn);
+         }
+      
+         while (conn.sent < conn.out.size()) {
+            iovec iov[3];
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = size_t(conn.out.iovecs(conn.sent, iov));
+            auto sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (sent == -1) {
+               if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                  set_state(conn, connection::WRITING);
                   return true;
                }
-               std::this_thread::sleep_for(poll_wait);
-               continue;                     
+               if (errno == EINTR) {
+                  continue;
+               }
+               // Failed to send data, close connection.
+               _stats.errors.fetch_add(1, std::memory_order_relaxed);
+               return false;
             }
-            // Failed to receive data, close connection.
-            return true;
+            conn.sent += size_t(sent);
+            _stats.bytes_sent.fetch_add(uint64_t(sent), std::memory_order_relaxed);
+         }
+         
+         // Response sent.
+         
+         conn.out.clear();
+         conn.sent = 0;
 
+         if (conn.stream.active) {
+            // Chunk of streamed response sent, continue with the next.
+            conn.stream.chunk->clear();
+            stream_chunk(conn.out, conn.stream);
+            continue;
          }
-         data.write(buf, received);
-         data.seekg(-4, data.end);
-         data.read(buf, 4);
-         if (strncmp("\r\n\r\n", buf, 4) == 0) {
-            // We have end of http request, read is complete.
-            break;
+
+         if (conn.close) {
+            // The response ended the connection, pipelined requests after it are not answered.
+            conn.in.clear();
+            return false;
+         }
+
+         if (find_request_end(conn.in) != std::string::npos) {
+            // Pipelined request already received.
+            respond(conn);
+            continue;
          }
+
+         set_state(conn, connection::READING);
+         conn.timeout_time = clock::now() + (conn.in.empty() ? KEEP_ALIVE_MAX_IDLE_TIME : REQUEST_MAX_TIME);
+         return true;
       }
+   }
 
-      // Parse and create response.
-      std::string response = do_http(data);
+   int http_status_server::response::iovecs(size_t offset, iovec* iov) const
+   {
+      const char* segments[3] = {head.data(), body ? body->data() + body_offset : nullptr, tail};
+      size_t sizes[3] = {head.size(), body ? body->size() - body_offset : 0, tail_size};
+      int count = 0;
+      for (int i = 0; i < 3; ++i) {
+         if (offset >= sizes[i]) {
+            offset -= sizes[i];
+            continue;
+         }
+         iov[count].iov_base = const_cast<char*>(segments[i] + offset);
+         iov[count].iov_len = sizes[i] - offset;
+         offset = 0;
+         ++count;
+      }
+      return count;
+   }
 
-      // Send response.
-      while (response.size()) {
-         if (_stop) return false;
+   void http_status_server::response::clear()
+   {
+      head.clear();
+      body.reset();
+      body_offset = 0;
+      tail = "";
+      tail_size = 0;
+   }
+   
+   void http_status_server::set_state(connection& conn, connection::state_t state)
+   {
+      uint32_t events = state == connection::READING ? EPOLLIN : EPOLLOUT;
+      if (conn.events != events) {
+         set_interest(EPOLL_CTL_MOD, conn.fd, events);
+         conn.events = events;
+      }
+      conn.state = state;
+   }
+   
+   void http_status_server::respond(connection& conn)
+   {
+      auto end = find_request_end(conn.in);
+      bool keep_alive = _keep_alive and not conn.close;
+      conn.out.clear();
+      do_http(conn.in.data(), end, keep_alive, conn.out, conn.stream);
+      conn.in.erase(0, end);
+      conn.close = not keep_alive;
+      conn.sent = 0;
+      conn.state = connection::WRITING;
+      _stats.requests.fetch_add(1, std::memory_order_relaxed);
+   }
 
-         auto sent = send(server, response.c_str(), response.size(), 0);
-         if (sent == -1) {
-            if (errno == EAGAIN) {
-               if (std::chrono::high_resolution_clock::now() > request_timeout_time) {
-                  // Request max time reached.
-                  return true;
-               }
-               std::this_thread::sleep_for(poll_wait);
-               continue;
-            }
-            // Failed to send data, close connection.
+   bool http_status_server::evict_idle_connection()
+   {
+      for (auto& p : _connections) {
+         if (p.second.state == connection::READING and p.second.in.empty()) {
+            close_connection(p.first);
             return true;
          }
-         response.erase(0, sent);
       }
-      return true;
+      return false;
    }
+   
+   void http_status_server::close_connection(int fd)
+   {
+      close_socket(fd);
+      _connections.erase(fd);
 
-   inline std::string error_response(const std::string& message)
+      if (not _accepting and _connections.size() < CONNECTIONS_MAX) {
+         set_accepting(true);
+      }
+   }
+   
+   void http_status_server::close_connections()
    {
-      return "HTTP/1.1 400 " + message + "\r\n\r\n";
+      for (auto& p : _connections) {
+         close_socket(p.first);
+      }
+      _connections.clear();
+      
+      if (not _accepting) {
+         set_accepting(true);
+      }
+   }
+   
+   void http_status_server::error_response(write_buffer& out, const char* message)
+   {
+      _stats.errors.fetch_add(1, std::memory_order_relaxed);
+      out.append("HTTP/1.1 400 ");
+      out.append(message);
+      out.append("\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
    }
 
-   std::string http_status_server::do_http(std::stringstream& request)
+   // Find the header name (lower case) in the request and set value to its value (without surrounding white space),
+   // returns false if not found.
+   inline bool header_value(const char* request, size_t size, const std::string& name, std::string& value)
+   {
+      auto end = request + size;
+      auto header = "\r\n" + name + ":";
+      auto ci_equal = [](char a, char b) { return tolower(a) == tolower(b); };
+      auto index = std::search(request, end, header.begin(), header.end(), ci_equal);
+      if (index == end) {
+         return false;
+      }
+      auto value_begin = index + header.size();
+      auto value_end = std::search(value_begin, end, "\r\n", "\r\n" + 2);
+      while (value_begin < value_end and isspace(*value_begin)) ++value_begin;
+      while (value_end > value_begin and isspace(*(value_end - 1))) --value_end;
+      value.assign(value_begin, value_end);
+      return true;
+   }
+   
+   // Returns true if the request has the header name (lower case) with a value containing value (case insensitive).
+   inline bool has_header_value(const char* request, size_t size, const std::string& name, const std::string& value)
+   {
+      std::string header;
+      if (not header_value(request, size, name, header)) {
+         return false;
+      }
+      auto ci_equal = [](char a, char b) { return tolower(a) == tolower(b); };
+      return std::search(header.begin(), header.end(), value.begin(), value.end(), ci_equal) != header.end();
+   }
+   
+   // Returns true if the request has a "Connection: close" header.
+   inline bool has_connection_close(const char* request, size_t size)
    {
-      // Parse request.
+      return has_header_value(request, size, "connection", "close");
+   }
 
-      std::string method;
-      std::string url;
-      std::string version;
+   inline int hex_value(char c)
+   {
+      return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+   }
+   
+   // Find the request parameter name in url and url decode it into value, returns false if not found.
+   inline bool query_param(const std::string& url, const std::string& name, std::string& value)
+   {
+      auto query = url.find('?');
+      if (query == std::string::npos) {
+         return false;
+      }
+      
+      for (auto index = query + 1; index < url.size();) {
+         auto end = std::min(url.find('&', index), url.size());
+         auto value_index = index + name.size() + 1;
+         if (value_index <= end and url.compare(index, name.size(), name) == 0 and url[value_index - 1] == '=') {
+            value.clear();
+            for (auto i = value_index; i < end; ++i) {
+               if (url[i] == '%' and i + 2 < end and isxdigit(url[i + 1]) and isxdigit(url[i + 2])) {
+                  value += char(hex_value(url[i + 1]) * 16 + hex_value(url[i + 2]));
+                  i += 2;
+               }
+               else if (url[i] == '+') {
+                  value += ' ';
+               }
+               else {
+                  value += url[i];
+               }
+            }
+            return true;
+         }
+         index = end + 1;
+      }
+      return false;
+   }
+   
+   void http_status_server::do_http(const char* request, size_t size, bool& keep_alive, response& response,
+                                    stream_state& stream)
+   {
+      auto& out = response.head;
 
-      request.seekg(0);
-      if (not request.good()) return error_response("empty request");
+      // Errors will close the connection.
+      bool req_keep_alive = keep_alive;
+      keep_alive = false;
       
-      std::getline(request, method, ' ');
-      if (not request.good()) return error_response("missing method");
-      if (method != "GET") return error_response("only get is supported");
+      // Parse request line.
+
+      auto end = request + size;
+      if (size == 0) return error_response(out, "empty request");
       
-      std::getline(request, url, ' ');
-      if (not request.good()) return error_response("missing url");
+      auto method_end = std::find(request, end, ' ');
+      if (method_end == end) return error_response(out, "missing method");
+      if (std::string(request, method_end) != "GET") return error_response(out, "only get is supported");
+
+      auto url_start = method_end + 1;
+      auto url_end = std::find(url_start, end, ' ');
+      if (url_end == end) return error_response(out, "missing url");
+      std::string url(url_start, url_end);
+
+      auto version_start = url_end + 1;
+      auto version_end = std::find(version_start, end, '\r');
+      if (version_end == end) return error_response(out, "missing version");
+      if (std::string(version_start, version_end) != "HTTP/1.1") {
+         return error_response(out, "only http/1.1 is supported");
+      }
       
-      std::getline(request, version, '\r');
-      if (not request.good()) return error_response("missing version");
-      if (version != "HTTP/1.1") return error_response("only http/1.1 is supported");
+      keep_alive = req_keep_alive and not has_connection_close(request, size);
 
       std::string cb;
+      query_param(url, "callback", cb);
+
+      glo::filter filter;
+      std::string level;
+      if (query_param(url, "level", level)) {
+         try {
+            filter.max_level = level_t(std::stoul(level));
+         }
+         catch (const std::logic_error&) {
+            keep_alive = false;
+            return error_response(out, "bad level");
+         }
+      }
+      query_param(url, "prefix", filter.key_prefix);
+      query_param(url, "tag", filter.tag);
+
+      auto format = JSON;
+      std::string format_param;
+      std::string schema_param;
+      if (url.substr(0, url.find('?')) == "/metrics") {
+         format = PROMETHEUS;
+      }
+      else if ((query_param(url, "format", format_param) and format_param == "binary")
+               or has_header_value(request, size, "accept", "application/x-glo-binary")) {
+         format = BINARY;
+         query_param(url, "schema", schema_param);
+      }
+      
+      std::string history_param;
+      double history_seconds = 0;
+      if (format == JSON and query_param(url, "history", history_param)) {
+         try {
+            history_seconds = std::stod(history_param);
+         }
+         catch (const std::logic_error&) {
+            keep_alive = false;
+            return error_response(out, "bad history");
+         }
+      }
       
-      auto index = url.find("callback=");
-      if (index != std::string::npos and index > 0 and (url[index - 1] == '?' or url[index - 1] == '&')) {
-         auto end = url.find('&', index + 9);
-         if (end == std::string::npos) {
-            cb = url.substr(index + 9);
+      std::string since_param;
+      uint64_t since = 0;
+      bool has_since = false;
+      bool track = format == JSON and (query_param(url, "since", since_param)
+                                       or header_value(request, size, "if-none-match", since_param));
+      if (track) {
+         since_param.erase(std::remove(since_param.begin(), since_param.end(), '"'), since_param.end());
+         try {
+            since = std::stoull(since_param);
+            has_since = true;
+         }
+         catch (const std::logic_error&) {
+            // Not a generation from this server, respond with everything.
+         }
+      }
+      
+      // Format response.
+      
+      auto chunk_size = format == JSON ? _stream_chunk_size.load() : 0;
+      if (format != JSON) {
+         cb.clear();
+      }
+
+      auto append_headers = [&](const char* status) {
+         out.append(status);
+         if (format == PROMETHEUS) {
+            out.append("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n");
+         }
+         else if (format == BINARY) {
+            out.append("Content-Type: application/x-glo-binary\r\n");
+         }
+         else if (cb.length()) {
+            out.append("Content-Type: application/javascript; charset=utf-8\r\n");
          }
          else {
-            cb = url.substr(index + 9, end - index - 9);
+            out.append("Content-Type: application/json; charset=utf-8\r\n");
+         }
+         out.append(keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+         out.append("Cache-Control: no-cache, no-store\r\n");
+      };
+      
+      // Append a body formatted for this response (not a shared snapshot).
+      auto append_body = [&](const write_buffer& body) {
+         out.append("Content-Length: ");
+         format_uint(out, body.size() + (cb.length() ? cb.length() + 3 : 0));
+         out.append("\r\n\r\n");
+         if (cb.length()) {
+            out.append(cb);
+            out.append('(');
          }
+         out.append(body);
+         if (cb.length()) {
+            out.append(");");
+         }
+      };
+
+      if (history_param.length()) {
+         append_headers("HTTP/1.1 200 OK\r\n");
+         _delta_body.clear();
+         format_history(_delta_body, history_seconds);
+         return append_body(_delta_body);
+      }
+      
+      if (chunk_size) {
+         append_headers("HTTP/1.1 200 OK\r\n");
+         out.append("Transfer-Encoding: chunked\r\n\r\n");
+         stream.active = true;
+         stream.filter = filter;
+         stream.cb = cb;
+         stream.position = 0;
+         stream.delimiter = "";
+         stream.items = 0;
+         if (not stream.chunk) {
+            stream.chunk = std::make_shared<write_buffer>();
+         }
+         auto& chunk = *stream.chunk;
+         chunk.clear();
+         if (cb.length()) {
+            chunk.append(cb);
+            chunk.append('(');
+         }
+         std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+         chunk.append("{\"version\":4,\"timestamp\":");
+         format_double(chunk, now.count());
+         chunk.append(",\"items\":[");
+         return stream_chunk(response, stream);
       }
 
-      // Format response.
+      std::shared_ptr<const delta_state> delta;
+      auto content = snapshot(_max_age, filter, format, track ? &delta : nullptr);
+
+      if (delta and has_since and since == delta->generation) {
+         append_headers("HTTP/1.1 304 Not Modified\r\n");
+         out.append("ETag: \"");
+         format_uint(out, delta->generation);
+         out.append("\"\r\n\r\n");
+         return;
+      }
+
+      append_headers("HTTP/1.1 200 OK\r\n");
+      if (delta) {
+         out.append("ETag: \"");
+         format_uint(out, delta->generation);
+         out.append("\"\r\n");
+      }
+
+      if (delta and has_since and since >= delta->first and since < delta->generation) {
+         // Only changed items and removed keys, copied from the snapshot.
+         auto& body = _delta_body;
+         body.clear();
+         std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+         body.append("{\"version\":4,\"timestamp\":");
+         format_double(body, now.count());
+         body.append(",\"generation\":");
+         format_uint(body, delta->generation);
+         body.append(",\"since\":");
+         format_uint(body, since);
+         body.append(",\"items\":[");
+         const char* delimiter = "";
+         for (auto& entry : delta->entries) {
+            if (entry.changed > since) {
+               body.append(delimiter);
+               body.append(content->data() + entry.begin, entry.end - entry.begin);
+               delimiter = ",";
+            }
+         }
+         body.append("],\"removed\":[");
+         delimiter = "";
+         for (auto removed = delta->removed.get(); removed and removed->generation > since;
+              removed = removed->older.get()) {
+            body.append(delimiter);
+            body.append('"');
+            body.append(removed->key);
+            body.append('"');
+            delimiter = ",";
+         }
+         body.append("]}");
+         return append_body(body);
+      }
       
-      std::stringstream content;
+      if (format == BINARY and schema_param.length()
+          and schema_param == std::to_string(binary_read_u64(content->data() + BINARY_SCHEMA_VERSION_OFFSET))) {
+         // The client has the schema, send the header with schema size 0 and then skip the schema.
+         auto schema_size = binary_read_u32(content->data() + BINARY_SCHEMA_SIZE_OFFSET);
+         out.append("Content-Length: ");
+         format_uint(out, content->size() - schema_size);
+         out.append("\r\n\r\n");
+         out.append(content->data(), BINARY_SCHEMA_SIZE_OFFSET);
+         binary_append_u32(out, 0);
+         response.body_offset = BINARY_HEADER_SIZE + schema_size;
+         response.body = std::move(content);
+         return;
+      }
       
-      content << std::setprecision(19);
+      out.append("Content-Length: ");
+      format_uint(out, content->size() + (cb.length() ? cb.length() + 3 : 0));
+      out.append("\r\n\r\n");
       
+      // The snapshot is sent directly from the shared buffer.
       if (cb.length()) {
-         content << cb << "(";
+         out.append(cb);
+         out.append('(');
+         response.tail = ");";
+         response.tail_size = 2;
+      }
+      response.body = std::move(content);
+   }
+   
+   void http_status_server::stream_chunk(response& out, stream_state& stream)
+   {
+      auto& chunk = *stream.chunk;
+      auto chunk_size = std::max(_stream_chunk_size.load(), size_t(1));
+      stream.items += json_format_items_part(chunk, stream.delimiter, stream.filter, stream.position, chunk_size);
+      bool last = stream.position == SIZE_MAX;
+      if (last) {
+         chunk.append("]}");
+         if (stream.cb.length()) {
+            chunk.append(");");
+         }
+         stream.active = false;
+         _stats.items.store(stream.items, std::memory_order_relaxed);
       }
-      
-      std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
-      content << "{\"version\":4,\"timestamp\":" << now.count() << ",\"items\":[";
 
-      const char* delimiter = "";
-      json_format_items(content, "", delimiter);
+      // Chunk size in hex, then the chunk (shared, not copied) and the chunk end (and the last empty chunk).
+      char hex[2 * sizeof(size_t)];
+      char* pos = hex + sizeof(hex);
+      auto size = chunk.size();
+      do {
+         *--pos = "0123456789abcdef"[size & 0xf];
+         size >>= 4;
+      } while (size);
+      out.head.append(pos, size_t(hex + sizeof(hex) - pos));
+      out.head.append("\r\n");
+      out.body = stream.chunk;
+      out.tail = last ? "\r\n0\r\n\r\n" : "\r\n";
+      out.tail_size = strlen(out.tail);
+   }
+   
+   std::shared_ptr<const write_buffer> http_status_server::snapshot(const clock::duration& max_age,
+                                                                    const filter& filter, format_t format,
+                                                                    std::shared_ptr<const delta_state>* delta)
+   {
+      std::string cache_key(1, format == PROMETHEUS ? 'p' : format == BINARY ? 'b' : delta ? 'd' : 'j');
+      cache_key.append(std::to_string(filter.max_level));
+      cache_key.append(1, '\n').append(filter.key_prefix).append(1, '\n').append(filter.tag);
       
-      content << "]}";
+      std::unique_lock<std::mutex> lock(_snapshot_mutex);
       
-      if (cb.length()) {
-         content << ");";
+      while (true) {
+         auto it = _snapshots.find(cache_key);
+         if (it != _snapshots.end() and it->second.content and clock::now() - it->second.time <= max_age) {
+            if (delta) *delta = it->second.delta;
+            return it->second.content;
+         }
+         
+         if (not _snapshot_running) {
+            break;
+         }
+
+         // Another thread is formatting, wait for it and use that one if it is for the same filter.
+         auto running = it != _snapshots.end() ? it->second.content : nullptr;
+         _snapshot_done.wait(lock, [this]() { return not _snapshot_running; });
+         it = _snapshots.find(cache_key);
+         if (it != _snapshots.end() and it->second.content and it->second.content != running) {
+            if (delta) *delta = it->second.delta;
+            return it->second.content;
+         }
+      }
+
+      // Reuse the buffer of the old snapshot if no one else is using it, it is taken out of the cache while
+      // formatting.
+      std::shared_ptr<write_buffer> content;
+      std::shared_ptr<const delta_state> new_delta;
+      auto it = _snapshots.find(cache_key);
+      auto previous_delta = it != _snapshots.end() ? it->second.delta : nullptr;
+      if (it != _snapshots.end() and it->second.content.use_count() == 1) {
+         content = std::const_pointer_cast<write_buffer>(std::move(it->second.content));
+         it->second.content.reset();
+         content->clear();
       }
+      else {
+         content = std::make_shared<write_buffer>();
+      }
+      
+      _snapshot_running = true;
+      auto start_time = clock::now();
+      lock.unlock();
+      
+      try {
+         size_t items;
+         if (format == PROMETHEUS) {
+            items = prometheus_format_items(*content, filter);
+         }
+         else if (format == BINARY) {
+            // Format after the header, then fill in the header when the schema version is known.
+            std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+            size_t schema_size;
+            _binary_body.clear();
+            items = binary_format_items(_binary_body, filter, schema_size);
+            binary_append_header(*content, binary_hash(_binary_body.data(), schema_size), now.count(), items,
+                                 schema_size);
+            content->append(_binary_body);
+         }
+         else {
+            std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+            content->append("{\"version\":4,\"timestamp\":");
+            format_double(*content, now.count());
+            content->append(",\"items\":[");
 
-      auto content_str = content.str();
+            const char* delimiter = "";
+            if (delta) {
+               _item_begins.clear();
+               items = json_format_items(*content, "", delimiter, filter, &_item_begins);
+               new_delta = track_changes(*content, _item_begins, content->size(), previous_delta);
+               content->append("],\"generation\":");
+               format_uint(*content, new_delta->generation);
+               content->append('}');
+            }
+            else {
+               items = json_format_items(*content, "", delimiter, filter);
+               content->append("]}");
+            }
+         }
 
-      std::stringstream response;
+         _stats.items.store(items, std::memory_order_relaxed);
+         _stats.format_time.record(uint64_t(std::chrono::nanoseconds(clock::now() - start_time).count()));
+      }
+      catch (...) {
+         lock.lock();
+         _snapshot_running = false;
+         _snapshot_done.notify_all();
+         throw;
+      }
+      
+      lock.lock();
+      it = _snapshots.find(cache_key);
+      if (it == _snapshots.end()) {
+         if (_snapshots.size() >= SNAPSHOTS_MAX) {
+            // Make room by removing the oldest snapshot.
+            auto oldest = std::min_element(_snapshots.begin(), _snapshots.end(), [](const auto& a, const auto& b) {
+                  return a.second.time < b.second.time;
+               });
+            _snapshots.erase(oldest);
+         }
+         it = _snapshots.emplace(cache_key, cached_snapshot()).first;
+      }
+      it->second.content = content;
+      if (new_delta and it->second.delta) {
+         _spare_delta = std::const_pointer_cast<delta_state>(it->second.delta);
+      }
+      it->second.delta = new_delta;
+      it->second.time = start_time;
+      _snapshot_running = false;
+      _snapshot_done.notify_all();
+      if (delta) *delta = new_delta;
+      return content;
+   }
 
-      response << "HTTP/1.1 200 OK\r\n";
-      if (cb.length()) {
-         response << "Content-Type: application/javascript; charset=utf-8\r\n";
+   std::shared_ptr<const http_status_server::delta_state>
+   http_status_server::track_changes(const write_buffer& content, const std::vector<size_t>& item_begins,
+                                     size_t items_end, const std::shared_ptr<const delta_state>& previous)
+   {
+      // Reuse the entries of an old state if no one else uses it.
+      std::shared_ptr<delta_state> state;
+      if (_spare_delta and _spare_delta.use_count() == 1) {
+         state = std::move(_spare_delta);
+      }
+      else {
+         state = std::make_shared<delta_state>();
+      }
+      _spare_delta.reset();
+      auto generation = _generation + 1;
+      auto data = content.data();
+      auto count = item_begins.size();
+      
+      // Hash the items, the key starts after {"key":" and ends at the first " since it is escaped.
+      bool same_keys = previous and previous->entries.size() == count;
+      state->entries.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+         auto& entry = state->entries[i];
+         entry.begin = item_begins[i];
+         entry.end = i + 1 < count ? item_begins[i + 1] - 1 : items_end;
+         entry.key_begin = entry.begin + 8;
+         entry.key_end = size_t(std::find(data + entry.key_begin, data + entry.end, '"') - data);
+         entry.key_hash = binary_hash(data + entry.key_begin, entry.key_end - entry.key_begin);
+         entry.hash = binary_hash(data + entry.begin, entry.end - entry.begin);
+         same_keys = same_keys and previous->entries[i].key_hash == entry.key_hash;
+      }
+
+      bool changed = false;
+      state->removed = previous ? previous->removed : nullptr;
+      state->removed_count = previous ? previous->removed_count : 0;
+      if (same_keys) {
+         // The common case, same items in the same order.
+         for (size_t i = 0; i < count; ++i) {
+            auto& entry = state->entries[i];
+            auto& old = previous->entries[i];
+            entry.key_begin = old.key_begin;
+            entry.key_end = old.key_end;
+            entry.changed = entry.hash == old.hash ? old.changed : generation;
+            changed = changed or entry.hash != old.hash;
+         }
+         state->keys = previous->keys;
       }
       else {
-         response << "Content-Type: application/json; charset=utf-8\r\n";
+         // Items added or removed, match items by key.
+         changed = true;
+         std::unordered_map<uint64_t, const delta_state::entry*> old_entries;
+         if (previous) {
+            for (auto& old : previous->entries) {
+               old_entries[old.key_hash] = &old;
+            }
+         }
+         auto keys = std::make_shared<std::string>();
+         std::vector<uint64_t> added;
+         for (auto& entry : state->entries) {
+            auto old = old_entries.find(entry.key_hash);
+            entry.changed = generation;
+            if (old != old_entries.end()) {
+               if (old->second->hash == entry.hash) {
+                  entry.changed = old->second->changed;
+               }
+               old_entries.erase(old);
+            }
+            else {
+               added.push_back(entry.key_hash);
+            }
+            auto key_begin = keys->size();
+            keys->append(data + entry.key_begin, entry.key_end - entry.key_begin);
+            entry.key_begin = key_begin;
+            entry.key_end = keys->size();
+         }
+
+         // Keys added again are no longer removed.
+         if (state->removed and not added.empty()) {
+            std::sort(added.begin(), added.end());
+            bool readded = false;
+            for (auto r = state->removed.get(); r and not readded; r = r->older.get()) {
+               readded = std::binary_search(added.begin(), added.end(), r->key_hash);
+            }
+            if (readded) {
+               state->removed = copy_removed(state->removed, added, SIZE_MAX, state->removed_count);
+            }
+         }
+         
+         if (previous) {
+            for (auto& old : previous->entries) {
+               if (old_entries.count(old.key_hash)) {
+                  auto removed = std::make_shared<delta_state::removed_key>();
+                  removed->generation = generation;
+                  removed->key_hash = old.key_hash;
+                  removed->key = previous->keys->substr(old.key_begin, old.key_end - old.key_begin);
+                  removed->older = std::move(state->removed);
+                  state->removed = std::move(removed);
+                  ++state->removed_count;
+               }
+            }
+         }
+         state->keys = keys;
+      }
+
+      // Forget the oldest removed keys, deltas can not be made from before that.
+      state->first = previous ? previous->first : generation;
+      if (state->removed_count > 2 * DELTA_REMOVED_MAX) {
+         auto dropped = state->removed.get();
+         for (size_t i = 0; i < DELTA_REMOVED_MAX; ++i) {
+            dropped = dropped->older.get();
+         }
+         state->first = std::max(state->first, dropped->generation);
+         state->removed = copy_removed(state->removed, {}, DELTA_REMOVED_MAX, state->removed_count);
       }
-      response << "Cache-Control: no-cache, no-store" << "\r\n"
-               << "Content-Length: " << content_str.length() << "\r\n"
-               << "\r\n"
-               << content_str;
       
-      return response.str();
+      if (changed) {
+         _generation = generation;
+         state->generation = generation;
+      }
+      else {
+         state->generation = previous->generation;
+      }
+      return state;
+   }
+
+   std::shared_ptr<const http_status_server::delta_state::removed_key>
+   http_status_server::copy_removed(const std::shared_ptr<const delta_state::removed_key>& removed,
+                                    const std::vector<uint64_t>& skip_hashes, size_t limit, size_t& count)
+   {
+      std::vector<const delta_state::removed_key*> kept;
+      for (auto r = removed.get(); r and kept.size() < limit; r = r->older.get()) {
+         if (not std::binary_search(skip_hashes.begin(), skip_hashes.end(), r->key_hash)) {
+            kept.push_back(r);
+         }
+      }
+
+      // Link the copies from the oldest.
+      std::shared_ptr<const delta_state::removed_key> copy;
+      for (auto r = kept.rbegin(); r != kept.rend(); ++r) {
+         auto key = std::make_shared<delta_state::removed_key>(**r);
+         key->older = std::move(copy);
+         copy = std::move(key);
+      }
+      count = kept.size();
+      return copy;
    }
    
    template<typename Rep, typename Period>
-   void http_status_server::start(const std::chrono::duration<Rep, Period>& sleep_time)
+   void http_status_server::start(const std::chrono::duration<Rep, Period>& max_age)
    {
       std::lock_guard<std::mutex> lock(_mutex);
       if (!_server_thread) {
-         _server_thread = std::make_unique<std::thread>([this, sleep_time](){ this->serve_forever(sleep_time); });
+         _server_thread = std::make_unique<std::thread>([this, max_age](){ this->serve_forever(max_age); });
       }
    }
 
    void http_status_server::stop()
    {
       _stop = true;
+
+      // Wake up the server if blocked in epoll.
+      wake_up();
       
-      std::lock_guard<std::mutex> lock(_mutex);
-      if (_server_thread) {
-         _server_thread->join();
-         _server_thread.reset();
+      // Join without holding the mutex, the server thread locks it when reading values.
+      std::unique_ptr<std::thread> server_thread;
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         server_thread = std::move(_server_thread);
+      }
+      if (server_thread) {
+         server_thread->join();
+      }
+   }
+
+   void http_status_server::set_streaming(size_t chunk_size)
+   {
+      _stream_chunk_size = chunk_size;
+   }
+   
+   void http_status_server::add_statistics(const std::string& key_prefix)
+   {
+      auto stats = std::make_shared<group>(key_prefix);
+      stats->add(std::cref(_stats.requests), "/requests", {tag::COUNT}, level::LOW, "Number of requests served.");
+      stats->add(std::cref(_stats.bytes_sent), "/sent", {tag::SIZE, tag::TOTAL}, level::LOW, "Number of bytes sent.");
+      stats->add(std::cref(_stats.timeouts), "/timeouts", {tag::COUNT}, level::LOW,
+                 "Number of connections closed because of timeout.");
+      stats->add(std::cref(_stats.errors), "/errors", {tag::COUNT}, level::LOW,
+                 "Number of bad requests and connections closed because of errors.");
+      stats->add(std::cref(_stats.items), "/items", {tag::LAST}, level::LOW, "Number of items in the last snapshot.");
+      stats->add(&_stats.format_time, "/format", {}, level::LOW, "Time in ns formatting snapshots.");
+      stats->add(&lock_stats().wait_time, "/lock/wait", {}, level::LOW,
+                 "Time in ns waiting to lock value mutexes of all groups.");
+      stats->add(&lock_stats().hold_time, "/lock/hold", {}, level::LOW,
+                 "Time in ns value mutexes of all groups were held when reading values.");
+      stats->add(std::cref(lock_stats().try_lock_fail_count), "/lock/try_lock_fail", {tag::COUNT}, level::LOW,
+                 "Number of times value mutexes could not be locked (try lock).");
+      stats->add(&callback_stats().duration, "/callback", {}, level::LOW, "Time in ns calling value callbacks.");
+      stats->add(std::cref(callback_stats().slow_count), "/callback/slow", {tag::COUNT}, level::LOW,
+                 "Number of value callbacks slower than 1 ms.");
+      add_group(stats);
+   }
+
+   template<typename Rep, typename Period>
+   void http_status_server::start_sampler(const std::chrono::duration<Rep, Period>& interval, size_t samples,
+                                          const glo::filter& filter)
+   {
+      std::lock_guard<std::mutex> lock(_sampler_mutex);
+      if (not _sampler_thread) {
+         _sampler_stop = false;
+         auto sample_interval = std::chrono::duration_cast<clock::duration>(interval);
+         _sampler_thread = std::make_unique<std::thread>([this, sample_interval, samples, filter]() {
+               sample(sample_interval, std::max(samples, size_t(1)), filter);
+            });
+      }
+   }
+
+   void http_status_server::stop_sampler()
+   {
+      // Join without holding the mutex, the thread locks it between samples.
+      std::unique_ptr<std::thread> sampler_thread;
+      {
+         std::lock_guard<std::mutex> lock(_sampler_mutex);
+         _sampler_stop = true;
+         sampler_thread = std::move(_sampler_thread);
+      }
+      _sampler_stopped.notify_all();
+      if (sampler_thread) {
+         sampler_thread->join();
+      }
+   }
+
+   void http_status_server::sample(clock::duration interval, size_t samples, const glo::filter& filter)
+   {
+      // Buffers reused for all samples.
+      write_buffer body;
+      write_buffer data;
+      uint64_t sampled_changes = 0;
+      auto sample_time = clock::now();
+      
+      std::unique_lock<std::mutex> lock(_sampler_mutex);
+      while (not _sampler_stop) {
+         lock.unlock();
+         
+         // Only read the schema if anything changed since last time.
+         std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+         auto changes = group::changes().load();
+         bool schema = changes != sampled_changes;
+         size_t schema_size;
+         body.clear();
+         auto items = binary_format_items(body, filter, schema_size, schema);
+         
+         {
+            std::lock_guard<std::mutex> history_lock(_history_mutex);
+            auto& h = _history;
+            if (schema) {
+               auto version = binary_hash(body.data(), schema_size);
+               if (version != h.schema_version or samples != h.capacity or h.items.empty()) {
+                  // Items were added or removed, start a new history.
+                  data.clear();
+                  binary_append_header(data, version, now.count(), items, schema_size);
+                  data.append(body);
+                  binary_parse(data.data(), data.size(), h.items);
+                  h.schema_version = version;
+                  h.interval = std::chrono::duration<double>(interval).count();
+                  h.capacity = samples;
+                  h.count = 0;
+                  h.next = 0;
+                  h.timestamps.assign(samples, 0);
+                  h.types.assign(samples * h.items.size(), binary_type::NONE);
+                  h.values.assign(samples * h.items.size(), 0);
+               }
+               sampled_changes = changes;
+            }
+            
+            if (items == h.items.size()) {
+               auto types = body.data() + schema_size;
+               auto values = types + (items + 7) / 8 * 8;
+               for (size_t i = 0; i < items; ++i) {
+                  h.types[i * h.capacity + h.next] = binary_type_t(types[i]);
+                  h.values[i * h.capacity + h.next] = binary_read_u64(values + i * 8);
+               }
+               h.timestamps[h.next] = now.count();
+               h.next = (h.next + 1) % h.capacity;
+               h.count = std::min(h.count + 1, h.capacity);
+            }
+            else {
+               // Changed after reading changes, read the schema again next time.
+               sampled_changes = 0;
+            }
+         }
+         
+         // Keep a fixed rate, skipping samples if falling behind.
+         sample_time = std::max(sample_time + interval, clock::now());
+         lock.lock();
+         _sampler_stopped.wait_until(lock, sample_time, [this]() { return _sampler_stop; });
+      }
+   }
+
+   void http_status_server::format_history(write_buffer& body, double seconds)
+   {
+      std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+      body.append("{\"version\":4,\"timestamp\":");
+      format_double(body, now.count());
+      
+      // Copy the samples within seconds from now and format the item heads, then format the values without holding
+      // the mutex.
+      size_t count;
+      _history_heads.clear();
+      _history_head_ends.clear();
+      {
+         std::lock_guard<std::mutex> lock(_history_mutex);
+         auto& h = _history;
+         auto oldest = h.count < h.capacity ? 0 : h.next;
+         size_t skip = 0;
+         while (skip < h.count and h.timestamps[(oldest + skip) % h.capacity] < now.count() - seconds) {
+            ++skip;
+         }
+         count = h.count - skip;
+         auto items = h.items.size();
+         _history_timestamps.resize(count);
+         _history_types.resize(items * count);
+         _history_values.resize(items * count);
+         for (size_t k = 0; k < count; ++k) {
+            auto slot = (oldest + skip + k) % h.capacity;
+            _history_timestamps[k] = h.timestamps[slot];
+            for (size_t i = 0; i < items; ++i) {
+               _history_types[i * count + k] = h.types[i * h.capacity + slot];
+               _history_values[i * count + k] = h.values[i * h.capacity + slot];
+            }
+         }
+
+         body.append(",\"interval\":");
+         format_double(body, h.interval);
+         for (auto& item : h.items) {
+            _history_heads.append("{\"key\":\"");
+            json_escape(_history_heads, item.key);
+            _history_heads.append("\",\"level\":");
+            format_uint(_history_heads, item.level);
+            _history_heads.append(",\"desc\":\"");
+            json_escape(_history_heads, item.desc);
+            _history_heads.append("\",\"values\":[");
+            _history_head_ends.push_back(_history_heads.size());
+         }
+      }
+      
+      body.append(",\"timestamps\":[");
+      const char* delimiter = "";
+      for (auto timestamp : _history_timestamps) {
+         body.append(delimiter);
+         format_double(body, timestamp);
+         delimiter = ",";
+      }
+      body.append("],\"items\":[");
+      size_t head_begin = 0;
+      for (size_t i = 0; i < _history_head_ends.size(); ++i) {
+         if (i) body.append(',');
+         body.append(_history_heads.data() + head_begin, _history_head_ends[i] - head_begin);
+         head_begin = _history_head_ends[i];
+         for (size_t k = 0; k < count; ++k) {
+            if (k) body.append(',');
+            auto type = _history_types[i * count + k];
+            auto value = _history_values[i * count + k];
+            if (type == binary_type::UINT64) {
+               format_uint(body, value);
+            }
+            else if (type == binary_type::INT64) {
+               format_int(body, int64_t(value));
+            }
+            else if (type == binary_type::FLOAT64) {
+               double d;
+               memcpy(&d, &value, sizeof(d));
+               format_double(body, d);
+            }
+            else {
+               body.append("null");
+            }
+         }
+         body.append("]}");
       }
+      body.append("]}");
    }
 }
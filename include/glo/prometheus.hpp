@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <glo/common.hpp>
+
+
+namespace glo {
+
+   //
+   // Helpers for formatting items in the Prometheus text exposition format (version 0.0.4).
+   //
+   // Items are mapped to metrics like this: the name is the key with all chars not allowed in metric names replaced by
+   // _ (and leading _ removed) followed by _<tag> for each tag, a percentile tag (like tag::P99) is a quantile label
+   // instead. The type is gauge for items tagged with a percentile, min, max, mean, current or last, otherwise
+   // counter for items tagged with count or total, gauge for size and untyped for everything else. The help is the
+   // description. Only items with numeric or boolean values are formatted.
+   //
+   // A name starting with a digit gets a leading _. Samples of items with the same metric name are output together
+   // after one help and type line. Values with a Prometheus type in their value_traits (like histogram) are one
+   // metric family formatted by the traits (named from the key and the tags of the value), the items of the value
+   // are then left out.
+   //
+
+   //
+   // Static parts of an item in Prometheus format, from the tags and description, see above.
+   //
+   struct prometheus_spec
+   {
+      prometheus_spec() {}
+      inline prometheus_spec(const tags_t& tags, const std::string& desc);
+
+      // Appended to the name from the key.
+      std::string suffix;
+
+      // Labels including {}, or empty.
+      std::string labels;
+
+      // Type of the metric, nullptr if the item is left out.
+      const char* type{"untyped"};
+
+      // True if the value formats the whole metric family (the labels are not used).
+      bool family{false};
+
+      // Escaped help text.
+      std::string help;
+   };
+
+   // Append str to buf with all chars not allowed in metric names replaced by _.
+   inline void prometheus_name(write_buffer& buf, const std::string& str)
+   {
+      for (auto c : str) {
+         bool valid = (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9') or c == '_'
+            or c == ':';
+         buf.append(valid ? c : '_');
+      }
+   }
+
+   // Append help text to buf escaping \ and newline.
+   inline void prometheus_escape_help(write_buffer& buf, const std::string& str)
+   {
+      for (auto c : str) {
+         if (c == '\\') buf.append("\\\\");
+         else if (c == '\n') buf.append("\\n");
+         else buf.append(c);
+      }
+   }
+
+   // Convert the json formatted value at start to the end of buf to a Prometheus sample value in place. Returns false
+   // (leaving buf unchanged) if it is not a number or a boolean.
+   inline bool prometheus_value(write_buffer& buf, size_t start)
+   {
+      const char* value = buf.data() + start;
+      size_t size = buf.size() - start;
+      auto is = [value, size](const char* literal) {
+         return size == strlen(literal) and memcmp(value, literal, size) == 0;
+      };
+      const char* replacement = nullptr;
+      if (is("true")) replacement = "1";
+      else if (is("false")) replacement = "0";
+      else if (is("nan") or is("-nan")) replacement = "NaN";
+      else if (is("inf")) replacement = "+Inf";
+      else if (is("-inf")) replacement = "-Inf";
+      if (replacement) {
+         buf.truncate(start);
+         buf.append(replacement);
+         return true;
+      }
+      if (size == 0 or not ((value[0] >= '0' and value[0] <= '9') or value[0] == '-')) {
+         return false;
+      }
+      return std::all_of(value, value + size, [](char c) {
+         return (c >= '0' and c <= '9') or c == '.' or c == 'e' or c == 'E' or c == '+' or c == '-';
+      });
+   }
+
+   //
+   // Implementation.
+   //
+
+   prometheus_spec::prometheus_spec(const tags_t& tags, const std::string& desc)
+   {
+      static const tags_t quantiles = {tag::P50, tag::P90, tag::P99, tag::P999};
+      static const char* quantile_values[] = {"0.5", "0.9", "0.99", "0.999"};
+      static const tags_t gauges = {tag::MIN, tag::MAX, tag::MEAN, tag::CURRENT, tag::LAST};
+
+      write_buffer buf;
+      bool gauge = false;
+      bool counter = false;
+      bool size = false;
+      for (auto& tag : tags) {
+         auto quantile = std::find(quantiles.begin(), quantiles.end(), tag);
+         if (quantile != quantiles.end()) {
+            labels = std::string("{quantile=\"") + quantile_values[quantile - quantiles.begin()] + "\"}";
+            gauge = true;
+            continue;
+         }
+         buf.append('_');
+         prometheus_name(buf, tag);
+         gauge = gauge or std::find(gauges.begin(), gauges.end(), tag) != gauges.end();
+         counter = counter or tag == tag::COUNT or tag == tag::TOTAL;
+         size = size or tag == tag::SIZE;
+      }
+      suffix = buf.str();
+      type = gauge ? "gauge" : counter ? "counter" : size ? "gauge" : "untyped";
+
+      buf.clear();
+      prometheus_escape_help(buf, desc);
+      help = buf.str();
+   }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+#include <glo/common.hpp>
+
+
+namespace glo {
+
+   //
+   // Value of a trivially copyable type T (typically a struct of several fields) protected by a sequence lock. The
+   // writer never blocks, it bumps a sequence number before and after the update. Readers copy the value and retry if
+   // the sequence number shows that the copy may be torn, so readers always get a consistent copy.
+   //
+   // Only one thread may write at a time, use an application mutex or a single writer thread for multiple writers.
+   //
+   // Add fields to a group using group::add with a vector of field<T>, each field will be formatted as its own item
+   // from the same consistent copy, without locking the group mutex.
+   //
+   template<typename T>
+   struct seqlock_value
+   {
+      static_assert(std::is_trivially_copyable<T>::value, "seqlock_value requires a trivially copyable type");
+      
+      inline seqlock_value();
+      inline explicit seqlock_value(const T& value);
+
+      seqlock_value(const seqlock_value&) = delete;
+      seqlock_value& operator=(const seqlock_value&) = delete;
+
+      // Store a new value (writer only).
+      inline void store(const T& value);
+
+      // Update the value by calling f with a reference to a copy of the current value, then storing it (writer only).
+      template<typename F> void update(F f) { T value = read(); f(value); store(value); }
+      
+      // Get a consistent copy of the value, callable from any thread.
+      inline T load() const;
+      
+   private:
+
+      static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+      // Copy the value without checking the sequence number.
+      inline T read() const;
+      
+      std::atomic<uint64_t> _seq{0};
+      std::atomic<uint64_t> _words[WORDS];
+   };
+
+   //
+   // Implementation.
+   //
+
+   template<typename T> seqlock_value<T>::seqlock_value() : seqlock_value(T()) {}
+   
+   template<typename T> seqlock_value<T>::seqlock_value(const T& value)
+   {
+      for (auto& word : _words) {
+         word.store(0, std::memory_order_relaxed);
+      }
+      store(value);
+   }
+   
+   template<typename T> void seqlock_value<T>::store(const T& value)
+   {
+      uint64_t words[WORDS] = {};
+      memcpy(words, &value, sizeof(T));
+      auto seq = _seq.load(std::memory_order_relaxed);
+      _seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < WORDS; ++i) {
+         _words[i].store(words[i], std::memory_order_relaxed);
+      }
+      _seq.store(seq + 2, std::memory_order_release);
+   }
+
+   template<typename T> T seqlock_value<T>::read() const
+   {
+      uint64_t words[WORDS];
+      for (size_t i = 0; i < WORDS; ++i) {
+         words[i] = _words[i].load(std::memory_order_relaxed);
+      }
+      T value;
+      memcpy(&value, words, sizeof(T));
+      return value;
+   }
+   
+   template<typename T> T seqlock_value<T>::load() const
+   {
+      while (true) {
+         auto seq = _seq.load(std::memory_order_acquire);
+         if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+         }
+         T value = read();
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if (_seq.load(std::memory_order_relaxed) == seq) {
+            return value;
+         }
+      }
+   }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+
+#include <glo/common.hpp>
+
+
+namespace glo {
+
+   // Number of slots in a sharded_counter, threads are assigned slots round robin.
+   constexpr size_t SHARDED_COUNTER_SLOTS = 64;
+
+   // Distance between the slots of a sharded_counter, two cache lines to also avoid false sharing caused by adjacent
+   // cache line prefetching (and to not depend on the alignment of the counter itself).
+   constexpr size_t SHARDED_COUNTER_SLOT_SIZE = 128;
+   
+   //
+   // Counter for values incremented from many threads. Each thread increments its own slot so increments are
+   // uncontended relaxed adds, the slots are summed only when the value is read. Uses 8 KiB of memory.
+   //
+   // Can be added to a group by raw pointer, std::ref or std::shared_ptr, it will be read without locking the group
+   // mutex and is always tagged tag::COUNT.
+   //
+   struct sharded_counter
+   {
+      sharded_counter() {}
+
+      sharded_counter(const sharded_counter&) = delete;
+      sharded_counter& operator=(const sharded_counter&) = delete;
+
+      // Add n to the counter.
+      void add(uint64_t n) { _slots[slot_index()].value.fetch_add(n, std::memory_order_relaxed); }
+      
+      sharded_counter& operator++() { add(1); return *this; }
+      sharded_counter& operator+=(uint64_t n) { add(n); return *this; }
+
+      // Sum of all slots, increments made concurrently with the load may or may not be included.
+      inline uint64_t load() const;
+
+   private:
+
+      // Returns the slot index for the calling thread.
+      inline static size_t slot_index();
+
+      struct slot
+      {
+         std::atomic<uint64_t> value{0};
+         char padding[SHARDED_COUNTER_SLOT_SIZE - sizeof(std::atomic<uint64_t>)];
+      };
+      
+      slot _slots[SHARDED_COUNTER_SLOTS];
+   };
+
+   template<> struct value_traits<sharded_counter> : default_value_traits<sharded_counter>
+   {
+      static constexpr bool lock_free = true;
+      static tags_t tags() { return {tag::COUNT}; }
+   };
+   
+   inline void json_format(std::ostream& os, const sharded_counter& value) { os << value.load(); }
+   inline void json_format(write_buffer& buf, const sharded_counter& value) { format_uint(buf, value.load()); }
+   
+   //
+   // Implementation.
+   //
+
+   uint64_t sharded_counter::load() const
+   {
+      uint64_t sum = 0;
+      for (auto& slot : _slots) {
+         sum += slot.value.load(std::memory_order_relaxed);
+      }
+      return sum;
+   }
+   
+   size_t sharded_counter::slot_index()
+   {
+      static std::atomic<size_t> next_index{0};
+      static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % SHARDED_COUNTER_SLOTS;
+      return index;
+   }
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <glo/binary_format.hpp>
+#include <glo/common.hpp>
+#include <glo/status_group.hpp>
+
+
+namespace glo {
+
+   //
+   // Layout of the shared memory file, in native byte order (readers are on the same host):
+   //
+   // header, SHM_HEADER_SIZE bytes:
+   //   magic "GLOM" (4 bytes), u32 layout version (SHM_LAYOUT_VERSION), u64 sequence, u64 data size, u64 data capacity
+   //
+   // data, data capacity bytes:
+   //   data size bytes of items in the binary format with schema (see binary_format.hpp), written and read as 64 bit
+   //   words (the last word padded with zeros)
+   //
+   // The data is protected by the sequence the same way as seqlock_value, it is odd while the data is written. The
+   // file only grows, the capacity is updated (after growing the file) before data larger than the old capacity is
+   // written.
+   //
+
+   constexpr uint32_t SHM_LAYOUT_VERSION = 1;
+   constexpr size_t SHM_HEADER_SIZE = 64;
+
+   static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory export requires lock free 64 bit atomics");
+
+   struct shm_header
+   {
+      char magic[4];
+      uint32_t version;
+      std::atomic<uint64_t> seq;
+      std::atomic<uint64_t> size;
+      std::atomic<uint64_t> capacity;
+   };
+
+   static_assert(sizeof(shm_header) <= SHM_HEADER_SIZE, "shm header too large");
+
+   //
+   // A group exporting its items to a memory mapped file (typically under /dev/shm), refreshed from the values on an
+   // interval or by calling refresh. A reader process (see shm_reader) can then sample all values with plain loads,
+   // without any system calls and without ever locking the mutexes of the application. The file is removed when the
+   // exporter is destructed.
+   //
+   // This is for very frequent sampling on the same host, reading values still works like for the http status server
+   // (respecting set_try_lock and so on) but only once per interval regardless of the number of readers.
+   //
+   struct shm_exporter : public group
+   {
+      // Create the exporter and the file at path (an existing file is reused). Throws glo::os_error on failed
+      // system calls.
+      shm_exporter(const std::string& path) : _path(path) { open(); }
+      shm_exporter(const std::string& key_prefix, const std::string& path) : group(key_prefix), _path(path) { open(); }
+      shm_exporter(std::shared_ptr<std::mutex> mutex, const std::string& path) : group(mutex), _path(path) { open(); }
+      shm_exporter(const std::string& key_prefix, std::shared_ptr<std::mutex> mutex, const std::string& path)
+         : group(key_prefix, mutex), _path(path) { open(); }
+
+      // Read values and write them to the file. Returns the number of items.
+      inline size_t refresh();
+
+      // Start a thread calling refresh every interval. Does nothing if already started.
+      template<class Rep, class Period>
+      void start(const std::chrono::duration<Rep, Period>& interval);
+
+      // Stop the refresh thread if started.
+      inline void stop();
+
+      inline ~shm_exporter();
+
+   private:
+
+      // Create and map the file.
+      inline void open();
+
+      // Grow the file and the mapping to fit size bytes of data.
+      inline void grow(size_t size);
+
+      shm_header* header() { return reinterpret_cast<shm_header*>(_map); }
+      std::atomic<uint64_t>* words() { return reinterpret_cast<std::atomic<uint64_t>*>(_map + SHM_HEADER_SIZE); }
+
+      std::string _path;
+      int _fd{-1};
+      char* _map{nullptr};
+      size_t _map_size{0};
+
+      // Formatted data and the items before the header.
+      write_buffer _data;
+      write_buffer _body;
+
+      // Protects the file and the buffers.
+      std::mutex _refresh_mutex;
+
+      std::mutex _thread_mutex;
+      std::condition_variable _stop_cv;
+      bool _stop{false};
+      std::unique_ptr<std::thread> _thread;
+   };
+
+   //
+   // Reader of a file written by shm_exporter, sampling values without system calls (except when the file grows).
+   // Not thread safe.
+   //
+   struct shm_reader
+   {
+      // Open and map the file. Throws glo::os_error on failed system calls.
+      inline shm_reader(const std::string& path);
+
+      shm_reader(const shm_reader&) = delete;
+      shm_reader& operator=(const shm_reader&) = delete;
+
+      // Copy a consistent version of the data (the binary format with schema, see binary_format.hpp) into data.
+      // Returns false if the exporter has not written any data yet.
+      inline bool load(write_buffer& data);
+
+      inline ~shm_reader();
+
+   private:
+
+      // Map the whole file, returns false if it is not large enough for size bytes of data.
+      inline bool remap(size_t size);
+
+      const shm_header* header() const { return reinterpret_cast<const shm_header*>(_map); }
+
+      int _fd{-1};
+      char* _map{nullptr};
+      size_t _map_size{0};
+   };
+
+   //
+   // Implementation.
+   //
+
+   void shm_exporter::open()
+   {
+      _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (_fd == -1) {
+         throw os_error("failed to open shm file '" + _path + "'");
+      }
+      grow(0);
+
+      auto h = header();
+      if (memcmp(h->magic, "GLOM", 4) != 0 or h->version != SHM_LAYOUT_VERSION) {
+         h->seq.store(0, std::memory_order_relaxed);
+         h->size.store(0, std::memory_order_relaxed);
+         h->version = SHM_LAYOUT_VERSION;
+         std::atomic_thread_fence(std::memory_order_release);
+         memcpy(h->magic, "GLOM", 4);
+      }
+      else if (h->seq.load(std::memory_order_relaxed) & 1) {
+         // A previous writer stopped while writing.
+         h->seq.fetch_add(1, std::memory_order_release);
+      }
+      h->capacity.store(_map_size - SHM_HEADER_SIZE, std::memory_order_release);
+   }
+
+   void shm_exporter::grow(size_t size)
+   {
+      struct stat st;
+      if (fstat(_fd, &st) == -1) {
+         throw os_error("failed to stat shm file '" + _path + "'");
+      }
+      size_t file_size = std::max(size_t(st.st_size), size_t(4096));
+      while (file_size < SHM_HEADER_SIZE + size) {
+         file_size *= 2;
+      }
+      if (size_t(st.st_size) < file_size and ftruncate(_fd, file_size) == -1) {
+         throw os_error("failed to grow shm file '" + _path + "'");
+      }
+      if (_map) {
+         munmap(_map, _map_size);
+         _map = nullptr;
+      }
+      auto map = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+      if (map == MAP_FAILED) {
+         throw os_error("failed to map shm file '" + _path + "'");
+      }
+      _map = static_cast<char*>(map);
+      _map_size = file_size;
+   }
+
+   size_t shm_exporter::refresh()
+   {
+      std::lock_guard<std::mutex> lock(_refresh_mutex);
+
+      std::chrono::duration<double> now = std::chrono::system_clock::now().time_since_epoch();
+      size_t schema_size;
+      _body.clear();
+      auto items = binary_format_items(_body, filter(), schema_size);
+      _data.clear();
+      binary_append_header(_data, binary_hash(_body.data(), schema_size), now.count(), items, schema_size);
+      _data.append(_body);
+      auto size = _data.size();
+      memset(_data.extend((8 - size % 8) % 8), 0, (8 - size % 8) % 8);
+
+      auto h = header();
+      if (_data.size() > _map_size - SHM_HEADER_SIZE) {
+         grow(_data.size());
+         h = header();
+         h->capacity.store(_map_size - SHM_HEADER_SIZE, std::memory_order_release);
+      }
+
+      // Write like seqlock_value::store.
+      auto seq = h->seq.load(std::memory_order_relaxed);
+      h->seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      auto w = words();
+      for (size_t i = 0; i < _data.size() / 8; ++i) {
+         uint64_t word;
+         memcpy(&word, _data.data() + i * 8, 8);
+         w[i].store(word, std::memory_order_relaxed);
+      }
+      h->size.store(size, std::memory_order_relaxed);
+      h->seq.store(seq + 2, std::memory_order_release);
+      return items;
+   }
+
+   template<class Rep, class Period>
+   void shm_exporter::start(const std::chrono::duration<Rep, Period>& interval)
+   {
+      std::lock_guard<std::mutex> lock(_thread_mutex);
+      if (_thread) {
+         return;
+      }
+      _stop = false;
+      _thread = std::make_unique<std::thread>([this, interval]() {
+            std::unique_lock<std::mutex> lock(_thread_mutex);
+            while (not _stop) {
+               lock.unlock();
+               refresh();
+               lock.lock();
+               _stop_cv.wait_for(lock, interval, [this]() { return _stop; });
+            }
+         });
+   }
+
+   void shm_exporter::stop()
+   {
+      // Join without holding the mutex, the thread locks it between refreshes.
+      std::unique_ptr<std::thread> thread;
+      {
+         std::lock_guard<std::mutex> lock(_thread_mutex);
+         _stop = true;
+         thread = std::move(_thread);
+      }
+      _stop_cv.notify_all();
+      if (thread) {
+         thread->join();
+      }
+   }
+
+   shm_exporter::~shm_exporter()
+   {
+      stop();
+      if (_map) munmap(_map, _map_size);
+      if (_fd != -1) close(_fd);
+      unlink(_path.c_str());
+   }
+
+   shm_reader::shm_reader(const std::string& path)
+   {
+      _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (_fd == -1) {
+         throw os_error("failed to open shm file '" + path + "'");
+      }
+      if (not remap(0)) {
+         close(_fd);
+         throw os_error("shm file '" + path + "' is too small");
+      }
+   }
+
+   bool shm_reader::remap(size_t size)
+   {
+      struct stat st;
+      if (fstat(_fd, &st) == -1) {
+         throw os_error("failed to stat shm file");
+      }
+      if (size_t(st.st_size) < SHM_HEADER_SIZE + size) {
+         return false;
+      }
+      if (_map) {
+         munmap(_map, _map_size);
+         _map = nullptr;
+      }
+      auto map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, _fd, 0);
+      if (map == MAP_FAILED) {
+         throw os_error("failed to map shm file");
+      }
+      _map = static_cast<char*>(map);
+      _map_size = st.st_size;
+      return true;
+   }
+
+   bool shm_reader::load(write_buffer& data)
+   {
+      // Read like seqlock_value::load.
+      while (true) {
+         auto h = header();
+         if (memcmp(h->magic, "GLOM", 4) != 0 or h->version != SHM_LAYOUT_VERSION) {
+            return false;
+         }
+         auto seq = h->seq.load(std::memory_order_acquire);
+         if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+         }
+         auto size = h->size.load(std::memory_order_relaxed);
+         if (size == 0) {
+            return false;
+         }
+         auto word_count = (size + 7) / 8;
+         if (word_count * 8 > _map_size - SHM_HEADER_SIZE) {
+            remap(word_count * 8);
+            continue;
+         }
+         data.clear();
+         auto words = reinterpret_cast<const std::atomic<uint64_t>*>(_map + SHM_HEADER_SIZE);
+         auto p = data.extend(word_count * 8);
+         for (size_t i = 0; i < word_count; ++i) {
+            uint64_t word = words[i].load(std::memory_order_relaxed);
+            memcpy(p + i * 8, &word, 8);
+         }
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if (h->seq.load(std::memory_order_relaxed) == seq) {
+            data.truncate(size);
+            return true;
+         }
+      }
+   }
+
+   shm_reader::~shm_reader()
+   {
+      if (_map) munmap(_map, _map_size);
+      if (_fd != -1) close(_fd);
+   }
+}
@@ -1,12 +1,108 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <thread>
 
+#include <glo/binary_format.hpp>
 #include <glo/common.hpp>
+#include <glo/histogram.hpp>
+#include <glo/prometheus.hpp>
 
 
 namespace glo {
 
+   //
+   // Filter for selecting which items to format. The default filter matches all items.
+   //
+   struct filter
+   {
+      // Only items with a level less than or equal to max_level.
+      level_t max_level = std::numeric_limits<level_t>::max();
+
+      // Only items with a key starting with key_prefix.
+      std::string key_prefix;
+
+      // Only items having this tag, empty for all tags.
+      tag_t tag;
+
+      // Returns true if any key starting with a + b can match the key prefix of the filter.
+      inline bool may_match(const std::string& a, const std::string& b) const;
+
+      // Returns true if an item with the key a + b, tags and level matches the filter.
+      inline bool matches(const std::string& a, const std::string& b, const tags_t& tags, level_t level) const;
+   };
+   
+   template<typename T> struct seqlock_value;
+
+   // Callbacks taking longer than this are counted as slow in callback_stats().
+   constexpr std::chrono::nanoseconds CALLBACK_SLOW_TIME = std::chrono::milliseconds(1);
+   
+   //
+   // Statistics for callbacks added with group::add_cb, for all groups or for one callback with a budget.
+   //
+   struct callback_statistics
+   {
+      // Duration of callbacks in ns.
+      histogram duration;
+
+      // Number of callbacks taking more than CALLBACK_SLOW_TIME (or the budget of the callback).
+      std::atomic<uint64_t> slow_count{0};
+   };
+
+   // Get the process wide callback statistics.
+   inline callback_statistics& callback_stats()
+   {
+      static callback_statistics stats;
+      return stats;
+   }
+
+   //
+   // Statistics for value mutexes of all groups, updated when reading values.
+   //
+   struct lock_statistics
+   {
+      // Time in ns waiting to lock the value mutex, including failed attempts in try lock mode.
+      histogram wait_time;
+      
+      // Time in ns the value mutex was held.
+      histogram hold_time;
+
+      // Number of times the value mutex could not be locked in try lock mode.
+      std::atomic<uint64_t> try_lock_fail_count{0};
+   };
+
+   // Get the process wide lock statistics.
+   inline lock_statistics& lock_stats()
+   {
+      static lock_statistics stats;
+      return stats;
+   }
+   
+   //
+   // Description of a field of a struct T, for adding fields of a seqlock_value to a group. The key is appended to the
+   // key given when adding.
+   //
+   template<typename T>
+   struct field
+   {
+      template<typename M>
+      field(M T::* member, std::string key, glo::tags_t tags, glo::level_t level, std::string desc)
+         : key(key), tags(tags), level(level), desc(desc),
+           format([member](write_buffer& buf, const T& value) { json_format_any(buf, value.*member, 0); }) {}
+      
+      std::string key;
+      glo::tags_t tags;
+      glo::level_t level;
+      std::string desc;
+      std::function<void(write_buffer&, const T&)> format;
+   };
+   
    //
    // The group is the class where status values are added. This way the status server (which is alos a group) can know
    // what values to serve. A group can also contain other groups.
@@ -32,23 +128,101 @@ namespace glo {
       // Add a value of type V to be returned by status call. Any types are accepted as long as there is a json
       // formatter for it. If providing a mutex the default implementation will format values to json directly while
       // holding the mutex. Raw pointer, std::ref or std::shared_ptr to fundamental types will be copied while holding
-      // the mutex and then formatted afterwards trying to minimize the lock time.
+      // the mutex and then formatted afterwards trying to minimize the lock time. Raw pointer, std::ref or
+      // std::shared_ptr to std::atomic will be loaded (relaxed) and formatted without holding the mutex, a group with
+      // only atomics will never lock the mutex, the same goes for types with value_traits<T>::lock_free (like
+      // sharded_counter). Tags from value_traits<T>::tags() are added to the tags. Lock free types with
+      // value_traits<T>::items() (like histogram) are formatted as one item per entry, using the format function of
+      // the entry instead of JsonFormatter.
       template<typename V, typename JsonFormatter = json_formatter<V> >
       void add(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc);
 
-      // TODO Provide a callback for value V.
-      // template<typename V, typename JsonFormatter = json_formatter<V> >
-      // void add_cb(std::function<V()> cb, glo::spec spec) {}
+      // Add fields of a seqlock_value by raw pointer or std::shared_ptr, each field is formatted as its own item with
+      // key + field key. All fields are formatted from the same consistent copy of the value, read without locking
+      // the mutex.
+      template<typename T>
+      void add(const seqlock_value<T>* val, std::string key, std::vector<field<T>> fields)
+      {
+         add_fields(val, key, fields);
+      }
+      template<typename T>
+      void add(const std::shared_ptr<seqlock_value<T>>& val, std::string key, std::vector<field<T>> fields)
+      {
+         add_fields(val, key, fields);
+      }
+      
+      // Add a callback returning a value of type V (formatted with JsonFormatter) to be returned by status call. The
+      // callback is called when reading values, without holding the mutex. If refresh_interval is non-zero the
+      // result is reused by reads until refresh_interval has passed since it was called. Duration of callbacks are
+      // recorded in callback_stats(). If budget is non-zero the duration of this callback and the number of calls
+      // taking longer than budget are also added as items with keys key + "/callback" and key + "/callback/slow" (a
+      // callback can not be interrupted, the budget is only used to count slow calls).
+      template<typename F, typename V = decltype(std::declval<F>()()), typename JsonFormatter = json_formatter<V> >
+      void add_cb(F cb, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                  std::chrono::nanoseconds refresh_interval = std::chrono::nanoseconds(0),
+                  std::chrono::nanoseconds budget = std::chrono::nanoseconds(0));
+      
+      // Do not block on the mutex when reading values, instead try to lock it until timeout has passed (or only once
+      // for zero timeout). If the mutex could not be locked values needing the mutex are formatted as they were read
+      // the last time they could be read, with "stale":true and "age" (seconds since read) added to the item. Values
+      // never read are left out. This way reading values never makes application threads wait for the mutex.
+      inline void set_try_lock(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+      
+      // Record lock statistics for the value mutex of this group only (in addition to lock_stats()) and add them as
+      // items in this group with key + "/wait", key + "/hold" and key + "/try_lock_fail".
+      inline void add_lock_stats(const std::string& key = "/glo/lock");
       
       // Add a group to this group, optionally providing a key prefix for all keys in the group.
       inline void add_group(const std::shared_ptr<group>& group, const std::string& key_prefix);
       inline void add_group(const std::shared_ptr<group>& group);
       
       // Read values and format items in this group into the stream. Each key will have key_prefix prepended when
-      // formatting. Each item will be formatted as comma separated json dicts but no enclosing [] or ,.
+      // formatting. Each item will be formatted as comma separated json dicts but no enclosing [] or ,. Only items
+      // matching filter are read and formatted, groups that can not have any matching items are skipped without
+      // locking the value mutex. The group and all groups below are compiled into a flat table of items the first
+      // time and after any change to any group, then reading values is a linear pass over the table.
       // TODO Make private.
-      inline void json_format_items(std::ostream& os, const std::string key_prefix, const char*& delimiter);
+      inline void json_format_items(std::ostream& os, const std::string key_prefix, const char*& delimiter,
+                                    const filter& filter);
+      void json_format_items(std::ostream& os, const std::string key_prefix, const char*& delimiter)
+      {
+         json_format_items(os, key_prefix, delimiter, filter());
+      }
+
+      // Same as above but formatting into a buffer, this will not allocate any memory once buffers has grown large
+      // enough. Returns the number of items formatted. If item_begins is provided the position in buf of the start of
+      // each item is added to it.
+      inline size_t json_format_items(write_buffer& buf, const std::string& key_prefix, const char*& delimiter,
+                                      const filter& filter, std::vector<size_t>* item_begins = nullptr);
+
+      // Same as above (without key prefix) but formatting one part at a time, for streaming large groups with bounded
+      // memory. Formatting starts at position (0 for the first part) and stops after the first group making buf at
+      // least size_hint large. Position is updated to where the next part starts, or to SIZE_MAX if all items are
+      // formatted. Returns the number of items formatted. Adding values or groups between parts may cause items to be
+      // skipped or formatted twice.
+      inline size_t json_format_items_part(write_buffer& buf, const char*& delimiter, const filter& filter,
+                                           size_t& position, size_t size_hint);
+
+      // Read values and format items matching filter in the Prometheus text exposition format (see prometheus.hpp),
+      // one sample per item. Items without numeric or boolean values are left out. Returns the number of items
+      // formatted.
+      inline size_t prometheus_format_items(write_buffer& buf, const filter& filter);
+
+      // Read values and format items matching filter in the binary format (see binary_format.hpp), appending the
+      // schema, the types and the values. Items are included even if they could not be read (with type none) to keep
+      // the schema the same. Sets schema_size to the size of the schema, returns the number of items. If schema is
+      // false only the types and the values are appended (schema size is 0).
+      inline size_t binary_format_items(write_buffer& buf, const filter& filter, size_t& schema_size,
+                                        bool schema = true);
 
+   protected:
+
+      // Output formats, binary values is the binary format without the schema.
+      enum format_t { JSON, PROMETHEUS, BINARY, BINARY_VALUES };
+
+      // Counter increased on any change to any group, compiled tables older than this are compiled again.
+      static std::atomic<uint64_t>& changes() { static std::atomic<uint64_t> changes{1}; return changes; }
+      
    private:
 
       // Internal base class for referring values. When getting values locked_prepare will be called once while the
@@ -58,6 +232,31 @@ namespace glo {
       // Subclass template for object values, several Implementations, see below.
       template<typename V, typename JsonFormatter, typename Enable = void> struct object_value;
 
+      // Subclass template for one of the items of a lock free value with value_traits<T>::items().
+      template<typename V> struct item_value;
+
+      // Base for values of fundamental types (added by raw pointer, std::ref or std::shared_ptr) that are copied into
+      // _batch_snapshot by batch_copy while locked and formatted from there when unlocked.
+      struct batched_value;
+
+      // Source of a batched value, the address and size of the value.
+      struct batch_source
+      {
+         const void* address;
+         uint32_t size;
+      };
+
+      // Fundamental types up to 8 bytes are batched.
+      template<typename T> struct is_batched
+         : std::integral_constant<bool, std::is_arithmetic<T>::value and sizeof(T) <= sizeof(uint64_t)> { };
+      
+      // Subclass template for callback values.
+      template<typename V, typename JsonFormatter> struct callback_value;
+      
+      // Subclass template for a field of a seqlock_value, and the copy shared between all fields.
+      template<typename V, typename T> struct field_value;
+      template<typename T> struct field_copy;
+
       // Remove and check for shared_ptr.
       template<typename T> struct remove_shared_ptr { };
       template<typename T> struct remove_shared_ptr<std::shared_ptr<T>> { using type = T; };
@@ -65,24 +264,171 @@ namespace glo {
       // Remove and check for reference_wrapper.
       template<typename T> struct remove_reference_wrapper { };
       template<typename T> struct remove_reference_wrapper<std::reference_wrapper<T>> { using type = T; };
+
+      // Check for std::atomic.
+      template<typename T> struct is_atomic : std::false_type { };
+      template<typename T> struct is_atomic<std::atomic<T>> : std::true_type { };
+      template<typename T> struct remove_atomic { using type = T; };
+      template<typename T> struct remove_atomic<std::atomic<T>> { using type = T; };
+
+      // Remove raw pointer, shared_ptr or reference_wrapper (and const) to get the underlying value type.
+      template<typename T> struct remove_pointer_like { using type = T; };
+      template<typename T> struct remove_pointer_like<T*> { using type = typename std::remove_const<T>::type; };
+      template<typename T> struct remove_pointer_like<std::shared_ptr<T>> : remove_pointer_like<T*> { };
+      template<typename T> struct remove_pointer_like<std::reference_wrapper<T>> : remove_pointer_like<T*> { };
+
+      // Binary type of the (possibly atomic) value of V formatted with JsonFormatter, none (converted from json) for
+      // custom formatters.
+      template<typename V, typename JsonFormatter> static constexpr binary_type_t binary_type_for()
+      {
+         using T = typename remove_atomic<typename remove_pointer_like<V>::type>::type;
+         return std::is_same<JsonFormatter, json_formatter<V>>::value ? binary_type_of<T>() : binary_type::NONE;
+      }
+
+      // Get a reference to the value for raw pointer, shared_ptr and reference_wrapper.
+      template<typename T> static const T& deref(const T* p) { return *p; }
+      template<typename T> static const T& deref(const std::shared_ptr<T>& p) { return *p; }
+      template<typename T> static const T& deref(const std::reference_wrapper<T>& r) { return r.get(); }
+      
+      // Add fields of seqlock_value.
+      template<typename V, typename T> void add_fields(V val, std::string key, std::vector<field<T>> fields);
+      
+      // Add value (with the mutex locked), lock free values with items are added as one value per item.
+      template<typename V, typename JsonFormatter>
+      void add_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                     std::false_type lock_free);
+      template<typename V, typename JsonFormatter>
+      void add_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                     std::true_type lock_free);
+      
+      // A group in the compiled table, groups are in depth first order.
+      struct compiled_group
+      {
+         // The group, and the key prefix of the group (from the key prefix of the read and the prefixes of the groups
+         // above it, not including the key prefix of the group itself).
+         group* grp;
+         std::string key_prefix;
+
+         // Range of compiled items for the values of the group.
+         size_t items_begin;
+         size_t items_end;
+
+         // Index of the first compiled group after this group and all groups below it.
+         size_t next;
+      };
+
+      // A value in the compiled table.
+      struct compiled_item
+      {
+         value* val;
+
+         // Range in _compiled_heads with the escaped json for the item up to the value, {"key":"...","value":.
+         size_t head_begin;
+         size_t head_end;
+
+         // Ranges in _compiled_prometheus_heads with the help and type lines and with the sample up to the value (the
+         // metric name for a family), and the index of the first item with the same metric name. Set by
+         // compile_prometheus.
+         size_t prometheus_help_begin;
+         size_t prometheus_help_end;
+         size_t prometheus_begin;
+         size_t prometheus_end;
+         size_t prometheus_family;
+
+         // Range in _compiled_binary_heads with the binary schema entry, set by compile_binary.
+         size_t binary_begin;
+         size_t binary_end;
+      };
+
+      // Compile this group and all groups below it into a flat table (with the group mutex locked) if anything
+      // changed since last time or key_prefix is not the same.
+      inline void compile(const std::string& key_prefix);
+      inline void compile_group(group& group, std::string& key_prefix);
+
+      // Add the Prometheus heads to the compiled table if not already done since it was compiled.
+      inline void compile_prometheus();
+
+      // Add the binary schema entries to the compiled table if not already done since it was compiled.
+      inline void compile_binary();
+      
+      // Copy all batched values into _batch_snapshot (with the value mutex and the group mutex locked).
+      inline void batch_copy();
+      
+      // Format the items of a compiled group (with the group mutex locked) as json, in Prometheus format or in binary
+      // format (schema entries to buf, types and values to _binary_types and _binary_values), returns the number of
+      // items formatted.
+      inline size_t format_items(write_buffer& buf, const compiled_group& compiled, const char*& delimiter,
+                                 const filter& filter, format_t format = JSON);
       
       // Json format everything static in the item, from the known end of the key until the : before the item value.
       inline std::string format_item_spec(std::string key, glo::tags_t tags, glo::level_t level, std::string desc);
 
+      // Set the static parts of the value for the Prometheus and binary formats.
+      inline void set_format_specs(value& val, const glo::tags_t& tags, glo::level_t level, const std::string& desc);
+
       // Key prefix for all groups and items added.
       std::string _key_prefix;
 
+      // Try to lock value mutex using _lock_timeout, returns true if locked.
+      inline bool try_lock_value_mutex(std::unique_lock<std::mutex>& lock);
+      
       // Optional mutex for values, shared with application code.
       std::shared_ptr<std::mutex> _value_mutex;
 
+      // Try lock mode, see set_try_lock, protected by the group mutex.
+      bool _try_lock{false};
+      std::chrono::nanoseconds _lock_timeout{0};
+
+      // Lock statistics for this group only, see add_lock_stats, protected by the group mutex.
+      std::shared_ptr<lock_statistics> _lock_stats;
+
       // Vector with all added values in this group.
       std::vector<std::unique_ptr<value>> _values;
 
+      // Sources of all batched values and the contiguous buffer they are copied to, one slot per value.
+      std::vector<batch_source> _batch_sources;
+      std::vector<uint64_t> _batch_snapshot;
+
       // Vector with <prefix string, child group>.
       std::vector<std::pair<std::string, std::shared_ptr<group>>> _groups;
 
+      // Compiled table of all values in this group and all groups below it, used when reading values to get a linear
+      // pass over all values without building any strings. Protected by the group mutex.
+      uint64_t _compiled_changes{0};
+      std::string _compiled_key_prefix;
+      std::vector<compiled_group> _compiled_groups;
+      std::vector<compiled_item> _compiled_items;
+      write_buffer _compiled_heads;
+      bool _compiled_prometheus{false};
+      write_buffer _compiled_prometheus_heads;
+
+      // Item indexes and ranges of formatted Prometheus samples, to output them grouped by metric family. Protected by
+      // the group mutex.
+      struct prometheus_range
+      {
+         size_t family;
+         size_t item;
+         size_t begin;
+         size_t end;
+      };
+      write_buffer _prometheus_samples;
+      std::vector<prometheus_range> _prometheus_ranges;
+      bool _compiled_binary{false};
+      write_buffer _compiled_binary_heads;
+
+      // Buffers for types and values when formatting binary, reused to not allocate. Protected by the group mutex.
+      write_buffer _binary_types;
+      write_buffer _binary_values;
+      write_buffer _binary_value;
+
+      // Values to call locked_prepare for when reading values of a group, reused to not allocate.
+      std::vector<value*> _locked_prepare;
+
+      // Where to add the positions of formatted json items if not null, set by json_format_items.
+      std::vector<size_t>* _item_begins{nullptr};
+
    protected:
-      
+
       // Mutex for internal data structures.
       std::mutex _mutex;
    };
@@ -91,99 +437,181 @@ namespace glo {
    // Implementation.
    //
 
+   bool filter::may_match(const std::string& a, const std::string& b) const
+   {
+      auto a_len = std::min(key_prefix.size(), a.size());
+      if (key_prefix.compare(0, a_len, a, 0, a_len) != 0) {
+         return false;
+      }
+      if (key_prefix.size() <= a.size()) {
+         return true;
+      }
+      auto b_len = std::min(key_prefix.size() - a.size(), b.size());
+      return key_prefix.compare(a.size(), b_len, b, 0, b_len) == 0;
+   }
+
+   bool filter::matches(const std::string& a, const std::string& b, const tags_t& tags, level_t level) const
+   {
+      if (level > max_level) {
+         return false;
+      }
+      if (not tag.empty() and std::find(tags.begin(), tags.end(), tag) == tags.end()) {
+         return false;
+      }
+      return a.size() + b.size() >= key_prefix.size() and may_match(a, b);
+   }
+   
    struct group::value
    {
-      value(std::string item_spec) : item_spec(item_spec) {}
+      value(std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : key(key), tags(tags), level(level), item_spec(item_spec) {}
 
       value(const value&) = delete;
       value& operator=(const value&) = delete;
      
       virtual void locked_prepare() const {}
       
-      virtual void json_format(std::ostream& os) const {}
+      virtual void json_format(write_buffer& buf) const {}
+
+      // The value in the binary format, for values with a binary type.
+      virtual uint64_t binary_bits() const { return 0; }
+
+      // Format the samples of the metric family with the metric name of size bytes, for values with a family
+      // Prometheus spec.
+      virtual void prometheus_format(write_buffer& buf, const char* name, size_t size) const {}
+
+      // Returns false if the value can be read without holding the mutex, locked_prepare will then be called without
+      // holding the mutex.
+      virtual bool needs_lock() const { return true; }
       
       virtual ~value() {}
+
+      // Key (including group key prefix), tags and level, used for filtering.
+      std::string key;
+      glo::tags_t tags;
+      glo::level_t level;
       
       std::string item_spec;
+
+      // Static parts of the item in Prometheus format and the binary schema entry after the key, set when added.
+      prometheus_spec prometheus;
+      std::string binary_spec;
+
+      // Type in the binary format if known from the C++ type, set when added. Read with binary_bits, values without
+      // a type are converted from the json formatted value.
+      binary_type_t binary_type{binary_type::NONE};
+
+      // If the value was selected by the filter in the ongoing format, protected by the group mutex.
+      bool selected{false};
+
+      // True for values of fundamental types copied by group::batch_copy instead of locked_prepare, set when added.
+      bool batched{false};
+      
+      // When locked_prepare was last called (set before the call), protected by the group mutex.
+      std::chrono::steady_clock::time_point prepared_time;
    };
 
    // Fallback implementation for storing any kind of value, formatting when locked.
    template<typename V, typename JsonFormatter, typename Enable>
    struct group::object_value : public group::value
    {
-      object_value(V val, std::string item_spec) : value(item_spec), _val(val) {}
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : value(key, tags, level, item_spec), _val(val) {}
 
       object_value(const object_value&) = delete;
       object_value& operator=(const object_value&) = delete;
       
       virtual void locked_prepare() const override
       {
-         _formatter(_prepared, _val);
+         _prepared.clear();
+         format_with(_formatter, _prepared, _val);
       }
       
-      virtual void json_format(std::ostream& os) const override
+      virtual void json_format(write_buffer& buf) const override
       {
-         os << _prepared.str();
-         _prepared.str(std::string());
-         _prepared.clear();
-         _prepared << std::setprecision(19);
+         buf.append(_prepared);
       }
          
       virtual ~object_value() {}
 
       JsonFormatter _formatter;
       V _val;
-      mutable std::stringstream _prepared;
+      mutable write_buffer _prepared;
    };
 
-   // V is a pointer to fundamanetal type specialization, copying when locked, formatting
-   // when unlocked.
+   struct group::batched_value : public group::value
+   {
+      batched_value(const void* address, uint32_t size, std::string key, glo::tags_t tags, glo::level_t level,
+                    std::string item_spec)
+         : value(key, tags, level, item_spec), source{address, size} { batched = true; }
+
+      // Get the copy made by the last batch copy.
+      template<typename T> void read_copy(T& copy) const { memcpy(&copy, snapshot->data() + slot, sizeof(T)); }
+      
+      // Source of the value, and the snapshot and slot it is copied to.
+      batch_source source;
+      const std::vector<uint64_t>* snapshot{nullptr};
+      size_t slot{0};
+   };
+   
+   // V is a pointer to fundamanetal type specialization, copied in batch when locked, formatting when unlocked.
    template<typename V, typename JsonFormatter> struct group::object_value
-   <V, JsonFormatter, typename std::enable_if<std::is_fundamental<typename std::remove_pointer<V>::type>::value>::type>
-      : public group::value
+   <V, JsonFormatter, typename std::enable_if<group::is_batched<typename std::remove_pointer<V>::type>::value>::type>
+      : public group::batched_value
    {
-      object_value(V val, std::string item_spec) : value(item_spec), _val(val) {}
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : batched_value(val, sizeof(*val), key, tags, level, item_spec), _val(val)
+      {
+         binary_type = binary_type_for<V, JsonFormatter>();
+      }
 
       object_value(const object_value&) = delete;
       object_value& operator=(const object_value&) = delete;
       
-      virtual void locked_prepare() const override {
-         _copy = *_val;
+      virtual void json_format(write_buffer& buf) const override
+      {
+         read_copy(_copy);
+         format_with(_formatter, buf, &_copy);
       }
-      
-      virtual void json_format(std::ostream& os) const override
+
+      virtual uint64_t binary_bits() const override
       {
-         os << std::setprecision(19);
-         _formatter(os, &_copy);
+         read_copy(_copy);
+         return binary_bits_of(_copy);
       }
          
       virtual ~object_value() {}
    
       JsonFormatter _formatter;
       V _val;
-      mutable typename std::remove_pointer<V>::type _copy;
+      mutable typename std::remove_const<typename std::remove_pointer<V>::type>::type _copy;
    };
 
-   // V is a shared_ptr to fundamanetal type specialization, copying when locked, formatting when unlocked.
+   // V is a shared_ptr to fundamanetal type specialization, copied in batch when locked, formatting when unlocked.
    template<typename V, typename JsonFormatter> struct group::object_value
-   <V, JsonFormatter, typename std::enable_if<std::is_fundamental<typename group::remove_shared_ptr<V>::type>::value>::type>
-      : public group::value
+   <V, JsonFormatter, typename std::enable_if<group::is_batched<typename group::remove_shared_ptr<V>::type>::value>::type>
+      : public group::batched_value
    {
-      object_value(V val, std::string item_spec) :
-         value(item_spec), _val(val), _copy(std::make_shared<typename V::element_type>()) {}
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec) :
+         batched_value(val.get(), sizeof(*val), key, tags, level, item_spec), _val(val),
+         _copy(std::make_shared<typename V::element_type>())
+      {
+         binary_type = binary_type_for<V, JsonFormatter>();
+      }
 
       object_value(const object_value&) = delete;
       object_value& operator=(const object_value&) = delete;
       
-      virtual void locked_prepare() const override
+      virtual void json_format(write_buffer& buf) const override
       {
-         *_copy = *_val;
+         read_copy(*_copy);
+         format_with(_formatter, buf, _copy);
       }
-      
-      virtual void json_format(std::ostream& os) const override
+
+      virtual uint64_t binary_bits() const override
       {
-         os << std::setprecision(19);
-         _formatter(os, _copy);
+         read_copy(*_copy);
+         return binary_bits_of(*_copy);
       }
          
       virtual ~object_value() {}
@@ -193,28 +621,137 @@ namespace glo {
       mutable V _copy;
    };
 
-   // V is a reference_wrapper to fundamanetal type specialization, copying when locked, formatting when unlocked.
+   // V is a reference_wrapper to fundamanetal type specialization, copied in batch when locked, formatting when
+   // unlocked.
+   template<typename V, typename JsonFormatter> struct group::object_value
+   <V, JsonFormatter, typename std::enable_if<
+                         group::is_batched<typename std::remove_const<typename group::remove_reference_wrapper<V>::type>::type>::value
+                         >::type>
+      : public group::batched_value
+   {
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec) :
+         batched_value(&val.get(), sizeof(val.get()), key, tags, level, item_spec), _val(val), _copy(), _ref(_copy)
+      {
+         binary_type = binary_type_for<V, JsonFormatter>();
+      }
+
+      object_value(const object_value&) = delete;
+      object_value& operator=(const object_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override
+      {
+         read_copy(_copy);
+         format_with(_formatter, buf, _ref);
+      }
+
+      virtual uint64_t binary_bits() const override
+      {
+         read_copy(_copy);
+         return binary_bits_of(_copy);
+      }
+         
+      virtual ~object_value() {}
+   
+      JsonFormatter _formatter;
+      V _val;
+      mutable typename std::remove_const<typename V::type>::type _copy;
+      mutable V _ref;
+   };
+   
+   // V is a pointer to atomic specialization, loading and formatting without the lock.
    template<typename V, typename JsonFormatter> struct group::object_value
-   <V, JsonFormatter, typename std::enable_if<std::is_fundamental<typename group::remove_reference_wrapper<V>::type>::value>::type>
+   <V, JsonFormatter, typename std::enable_if<
+                         group::is_atomic<typename std::remove_const<typename std::remove_pointer<V>::type>::type>::value
+                         >::type>
       : public group::value
    {
-      object_value(V val, std::string item_spec) :
-         value(item_spec), _val(val), _copy(), _ref(_copy) {}
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : value(key, tags, level, item_spec), _val(val) { binary_type = binary_type_for<V, JsonFormatter>(); }
 
       object_value(const object_value&) = delete;
       object_value& operator=(const object_value&) = delete;
       
-      virtual void locked_prepare() const override
+      virtual void json_format(write_buffer& buf) const override
       {
-         _copy = _val;
+         _copy.store(_val->load(std::memory_order_relaxed), std::memory_order_relaxed);
+         format_with(_formatter, buf, &_copy);
       }
+
+      virtual uint64_t binary_bits() const override { return binary_bits_of(_val->load(std::memory_order_relaxed)); }
+
+      virtual bool needs_lock() const override { return false; }
       
-      virtual void json_format(std::ostream& os) const override
+      virtual ~object_value() {}
+   
+      JsonFormatter _formatter;
+      V _val;
+      mutable typename std::remove_const<typename std::remove_pointer<V>::type>::type _copy;
+   };
+
+   // V is a shared_ptr to atomic specialization, loading and formatting without the lock.
+   template<typename V, typename JsonFormatter> struct group::object_value
+   <V, JsonFormatter, typename std::enable_if<
+                         group::is_atomic<typename std::remove_const<typename group::remove_shared_ptr<V>::type>::type>::value
+                         >::type>
+      : public group::value
+   {
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec) :
+         value(key, tags, level, item_spec), _val(val),
+         _copy(std::make_shared<typename std::remove_const<typename V::element_type>::type>()), _ref(_copy)
       {
-         os << std::setprecision(19);
-         _formatter(os, _ref);
+         binary_type = binary_type_for<V, JsonFormatter>();
       }
-         
+
+      object_value(const object_value&) = delete;
+      object_value& operator=(const object_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override
+      {
+         _copy->store(_val->load(std::memory_order_relaxed), std::memory_order_relaxed);
+         format_with(_formatter, buf, _ref);
+      }
+
+      virtual uint64_t binary_bits() const override { return binary_bits_of(_val->load(std::memory_order_relaxed)); }
+
+      virtual bool needs_lock() const override { return false; }
+      
+      virtual ~object_value() {}
+   
+      JsonFormatter _formatter;
+      V _val;
+      std::shared_ptr<typename std::remove_const<typename V::element_type>::type> _copy;
+      V _ref;
+   };
+
+   // V is a reference_wrapper to atomic specialization, loading and formatting without the lock.
+   template<typename V, typename JsonFormatter> struct group::object_value
+   <V, JsonFormatter, typename std::enable_if<
+                         group::is_atomic<typename std::remove_const<typename group::remove_reference_wrapper<V>::type>::type>::value
+                         >::type>
+      : public group::value
+   {
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec) :
+         value(key, tags, level, item_spec), _val(val), _copy(), _ref(_copy)
+      {
+         binary_type = binary_type_for<V, JsonFormatter>();
+      }
+
+      object_value(const object_value&) = delete;
+      object_value& operator=(const object_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override
+      {
+         _copy.store(_val.get().load(std::memory_order_relaxed), std::memory_order_relaxed);
+         format_with(_formatter, buf, _ref);
+      }
+
+      virtual uint64_t binary_bits() const override
+      {
+         return binary_bits_of(_val.get().load(std::memory_order_relaxed));
+      }
+
+      virtual bool needs_lock() const override { return false; }
+      
       virtual ~object_value() {}
    
       JsonFormatter _formatter;
@@ -223,12 +760,285 @@ namespace glo {
       mutable V _ref;
    };
    
+   // V is a raw pointer, reference_wrapper or shared_ptr to a lock free type specialization, formatting without the
+   // lock.
+   template<typename V, typename JsonFormatter> struct group::object_value
+   <V, JsonFormatter, typename std::enable_if<value_traits<typename group::remove_pointer_like<V>::type>::lock_free>::type>
+      : public group::value
+   {
+      object_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : value(key, tags, level, item_spec), _val(val) {}
+
+      object_value(const object_value&) = delete;
+      object_value& operator=(const object_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override { format_with(_formatter, buf, _val); }
+
+      virtual bool needs_lock() const override { return false; }
+      
+      virtual ~object_value() {}
+   
+      JsonFormatter _formatter;
+      V _val;
+   };
+   
+   template<typename V> struct group::item_value : public group::value
+   {
+      using format_function = void (*)(write_buffer&, const typename group::remove_pointer_like<V>::type&);
+      using prometheus_function = void (*)(write_buffer&, const char*, size_t,
+                                           const typename group::remove_pointer_like<V>::type&);
+      
+      item_value(V val, format_function format, prometheus_function prometheus, std::string key, glo::tags_t tags,
+                 glo::level_t level, std::string item_spec)
+         : value(key, tags, level, item_spec), _val(val), _format(format), _prometheus(prometheus) {}
+
+      item_value(const item_value&) = delete;
+      item_value& operator=(const item_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override { _format(buf, deref(_val)); }
+
+      virtual void prometheus_format(write_buffer& buf, const char* name, size_t size) const override
+      {
+         _prometheus(buf, name, size, deref(_val));
+      }
+
+      virtual bool needs_lock() const override { return false; }
+      
+      virtual ~item_value() {}
+   
+      V _val;
+      format_function _format;
+      prometheus_function _prometheus;
+   };
+   
+   template<typename V, typename JsonFormatter> struct group::callback_value : public group::value
+   {
+      callback_value(std::function<V()> cb, std::chrono::nanoseconds refresh_interval, std::chrono::nanoseconds budget,
+                     std::shared_ptr<callback_statistics> stats, std::string key, glo::tags_t tags, glo::level_t level,
+                     std::string item_spec)
+         : value(key, tags, level, item_spec), _cb(cb), _refresh_interval(refresh_interval), _budget(budget),
+           _stats(stats) {}
+
+      callback_value(const callback_value&) = delete;
+      callback_value& operator=(const callback_value&) = delete;
+      
+      virtual void json_format(write_buffer& buf) const override
+      {
+         auto now = std::chrono::steady_clock::now();
+         if (_called_time == std::chrono::steady_clock::time_point() or now >= _called_time + _refresh_interval) {
+            auto val = _cb();
+            auto end = std::chrono::steady_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - now);
+            callback_stats().duration.record(uint64_t(duration.count()));
+            if (duration > CALLBACK_SLOW_TIME) {
+               callback_stats().slow_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (_stats) {
+               _stats->duration.record(uint64_t(duration.count()));
+               if (duration > _budget) {
+                  _stats->slow_count.fetch_add(1, std::memory_order_relaxed);
+               }
+            }
+            _result.clear();
+            format_with(_formatter, _result, val);
+            _called_time = now;
+         }
+         buf.append(_result);
+      }
+
+      virtual bool needs_lock() const override { return false; }
+      
+      virtual ~callback_value() {}
+   
+      JsonFormatter _formatter;
+      std::function<V()> _cb;
+      std::chrono::nanoseconds _refresh_interval;
+      std::chrono::nanoseconds _budget;
+      std::shared_ptr<callback_statistics> _stats;
+      mutable write_buffer _result;
+      mutable std::chrono::steady_clock::time_point _called_time;
+   };
+
+   template<typename F, typename V, typename JsonFormatter>
+   void group::add_cb(F cb, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                      std::chrono::nanoseconds refresh_interval, std::chrono::nanoseconds budget)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto item_spec = format_item_spec(key, tags, level, desc);
+      auto stats = budget.count() ? std::make_shared<callback_statistics>() : nullptr;
+      _values.emplace_back(std::make_unique<callback_value<V, JsonFormatter>>(cb, refresh_interval, budget, stats,
+                                                                              _key_prefix + key, tags, level,
+                                                                              item_spec));
+      set_format_specs(*_values.back(), tags, level, desc);
+      if (stats) {
+         using duration_ptr = std::shared_ptr<histogram>;
+         using slow_count_ptr = std::shared_ptr<std::atomic<uint64_t>>;
+         add_value<duration_ptr, json_formatter<duration_ptr>>(duration_ptr(stats, &stats->duration), key + "/callback",
+                                                               value_traits<histogram>::tags(), level,
+                                                               "Time in ns calling the callback.", std::true_type());
+         add_value<slow_count_ptr, json_formatter<slow_count_ptr>>(slow_count_ptr(stats, &stats->slow_count),
+                                                                   key + "/callback/slow", {tag::COUNT}, level,
+                                                                   "Calls of the callback taking longer than its "
+                                                                   "budget.", std::false_type());
+      }
+      ++changes();
+   }
+   
+   template<typename T> struct group::field_copy
+   {
+      T value;
+
+      // The prepared_time of the read the copy was made for.
+      std::chrono::steady_clock::time_point time;
+   };
+   
+   template<typename V, typename T> struct group::field_value : public group::value
+   {
+      field_value(V val, std::shared_ptr<field_copy<T>> copy, std::function<void(write_buffer&, const T&)> format,
+                  std::string key, glo::tags_t tags, glo::level_t level, std::string item_spec)
+         : value(key, tags, level, item_spec), _val(val), _copy(copy), _format(format) {}
+
+      field_value(const field_value&) = delete;
+      field_value& operator=(const field_value&) = delete;
+
+      // The first selected field of a read copies the value for all fields.
+      virtual void locked_prepare() const override
+      {
+         if (_copy->time != prepared_time) {
+            _copy->value = deref(_val).load();
+            _copy->time = prepared_time;
+         }
+      }
+      
+      virtual void json_format(write_buffer& buf) const override { _format(buf, _copy->value); }
+
+      virtual bool needs_lock() const override { return false; }
+      
+      virtual ~field_value() {}
+   
+      V _val;
+      std::shared_ptr<field_copy<T>> _copy;
+      std::function<void(write_buffer&, const T&)> _format;
+   };
+
+   template<typename V, typename T>
+   void group::add_fields(V val, std::string key, std::vector<field<T>> fields)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto copy = std::make_shared<field_copy<T>>();
+      for (auto& field : fields) {
+         auto item_spec = format_item_spec(key + field.key, field.tags, field.level, field.desc);
+         _values.emplace_back(std::make_unique<field_value<V, T>>(val, copy, field.format,
+                                                                  _key_prefix + key + field.key, field.tags,
+                                                                  field.level, item_spec));
+         set_format_specs(*_values.back(), field.tags, field.level, field.desc);
+      }
+      ++changes();
+   }
+   
    template<typename V, typename JsonFormatter>
    void group::add(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc)
    {
+      using traits = value_traits<typename remove_pointer_like<V>::type>;
+      for (auto& tag : traits::tags()) {
+         if (std::find(tags.begin(), tags.end(), tag) == tags.end()) {
+            tags.push_back(tag);
+         }
+      }
       std::lock_guard<std::mutex> lock(_mutex);
+      add_value<V, JsonFormatter>(val, key, tags, level, desc, std::integral_constant<bool, traits::lock_free>());
+      ++changes();
+   }
+
+   template<typename V, typename JsonFormatter>
+   void group::add_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                         std::false_type lock_free)
+   {
       auto item_spec = format_item_spec(key, tags, level, desc);
-      _values.emplace_back(std::make_unique<object_value<V, JsonFormatter>>(val, item_spec));
+      _values.emplace_back(std::make_unique<object_value<V, JsonFormatter>>(val, _key_prefix + key, tags, level,
+                                                                            item_spec));
+      set_format_specs(*_values.back(), tags, level, desc);
+      if (auto batched = dynamic_cast<batched_value*>(_values.back().get())) {
+         batched->snapshot = &_batch_snapshot;
+         batched->slot = _batch_sources.size();
+         _batch_sources.push_back(batched->source);
+         _batch_snapshot.resize(_batch_sources.size());
+      }
+   }
+   
+   template<typename V, typename JsonFormatter>
+   void group::add_value(V val, std::string key, glo::tags_t tags, glo::level_t level, std::string desc,
+                         std::true_type lock_free)
+   {
+      using traits = value_traits<typename remove_pointer_like<V>::type>;
+      auto items = traits::items();
+      if (items.empty()) {
+         add_value<V, JsonFormatter>(val, key, tags, level, desc, std::false_type());
+         return;
+      }
+      bool first = true;
+      for (auto& item : items) {
+         auto item_tags = tags;
+         item_tags.push_back(item.first);
+         auto item_spec = format_item_spec(key, item_tags, level, desc);
+         _values.emplace_back(std::make_unique<item_value<V>>(val, item.second, &traits::prometheus_format,
+                                                              _key_prefix + key, item_tags, level, item_spec));
+         set_format_specs(*_values.back(), item_tags, level, desc);
+         if (traits::prometheus_type()) {
+            // The first item is the whole metric family in Prometheus format, the other items are left out.
+            auto& spec = _values.back()->prometheus;
+            if (first) {
+               spec = prometheus_spec(tags, desc);
+               spec.type = traits::prometheus_type();
+               spec.family = true;
+            }
+            else {
+               spec.type = nullptr;
+            }
+         }
+         first = false;
+      }
+   }
+   
+   void group::set_try_lock(std::chrono::nanoseconds timeout)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _try_lock = true;
+      _lock_timeout = timeout;
+   }
+
+   bool group::try_lock_value_mutex(std::unique_lock<std::mutex>& lock)
+   {
+      lock = std::unique_lock<std::mutex>(*_value_mutex, std::try_to_lock);
+      if (lock.owns_lock() or _lock_timeout.count() == 0) {
+         return lock.owns_lock();
+      }
+      auto timeout_time = std::chrono::steady_clock::now() + _lock_timeout;
+      while (not lock.try_lock()) {
+         if (std::chrono::steady_clock::now() >= timeout_time) {
+            return false;
+         }
+         std::this_thread::yield();
+      }
+      return true;
+   }
+   
+   void group::add_lock_stats(const std::string& key)
+   {
+      std::shared_ptr<lock_statistics> stats;
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         if (not _lock_stats) {
+            _lock_stats = std::make_shared<lock_statistics>();
+         }
+         stats = _lock_stats;
+      }
+      add(std::shared_ptr<histogram>(stats, &stats->wait_time), key + "/wait", {}, level::LOW,
+          "Time in ns waiting to lock the value mutex of the group.");
+      add(std::shared_ptr<histogram>(stats, &stats->hold_time), key + "/hold", {}, level::LOW,
+          "Time in ns the value mutex of the group was held when reading values.");
+      add(std::shared_ptr<const std::atomic<uint64_t>>(stats, &stats->try_lock_fail_count), key + "/try_lock_fail",
+          {tag::COUNT}, level::LOW, "Number of times the value mutex of the group could not be locked (try lock).");
    }
    
    void group::add_group(const std::shared_ptr<group>& group)
@@ -240,47 +1050,462 @@ namespace glo {
    {
       std::lock_guard<std::mutex> lock(_mutex);
       _groups.emplace_back(make_pair(key_prefix, group));
+      ++changes();
+   }
+   
+   void group::set_format_specs(value& val, const glo::tags_t& tags, glo::level_t level, const std::string& desc)
+   {
+      val.prometheus = prometheus_spec(tags, desc);
+      write_buffer buf;
+      binary_append_u32(buf, level);
+      binary_append_u32(buf, uint32_t(desc.size()));
+      buf.append(desc);
+      val.binary_spec = buf.str();
    }
    
    std::string group::format_item_spec(std::string key, glo::tags_t tags, glo::level_t level, std::string desc)
    {
-      std::stringstream ss;
-      ss << escape_json(_key_prefix) << escape_json(key) << ":";
+      write_buffer buf;
+      json_escape(buf, _key_prefix);
+      json_escape(buf, key);
+      buf.append(':');
       const char* delimiter = "";
       for (auto tag : tags) {
-         ss << delimiter << tag;
+         buf.append(delimiter);
+         buf.append(tag);
          delimiter = "-";
       }
-      ss << "\",\"level\":" << level << ",\"desc\":\"" << escape_json(desc) << "\",\"value\":";
-      return ss.str();
+      buf.append("\",\"level\":");
+      format_uint(buf, level);
+      buf.append(",\"desc\":\"");
+      json_escape(buf, desc);
+      buf.append("\",\"value\":");
+      return buf.str();
    }
    
-   void group::json_format_items(std::ostream& os, const std::string key_prefix, const char*& delimiter)
+   void group::json_format_items(std::ostream& os, const std::string key_prefix, const char*& delimiter,
+                                 const filter& filter)
+   {
+      write_buffer buf;
+      json_format_items(buf, key_prefix, delimiter, filter);
+      os.write(buf.data(), std::streamsize(buf.size()));
+   }
+   
+   size_t group::json_format_items(write_buffer& buf, const std::string& key_prefix, const char*& delimiter,
+                                   const filter& filter, std::vector<size_t>* item_begins)
    {
       std::lock_guard<std::mutex> lock(_mutex);
-      {
-         std::unique_lock<std::mutex> value_lock;
-         if (_value_mutex) {
-            value_lock = std::unique_lock<std::mutex>(*_value_mutex);
+      compile(key_prefix);
+      _item_begins = item_begins;
+      size_t count = 0;
+      size_t i = 0;
+      while (i < _compiled_groups.size()) {
+         auto& compiled = _compiled_groups[i];
+         if (not filter.may_match(compiled.key_prefix, compiled.grp->_key_prefix)) {
+            i = compiled.next;
+            continue;
          }
+         count += format_items(buf, compiled, delimiter, filter);
+         ++i;
+      }
+      _item_begins = nullptr;
+      return count;
+   }
 
-         for (auto& value : _values) {
-            value->locked_prepare();
+   size_t group::json_format_items_part(write_buffer& buf, const char*& delimiter, const filter& filter,
+                                        size_t& position, size_t size_hint)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      compile("");
+      _item_begins = nullptr;
+      size_t count = 0;
+      size_t i = position;
+      while (i < _compiled_groups.size() and buf.size() < size_hint) {
+         auto& compiled = _compiled_groups[i];
+         if (not filter.may_match(compiled.key_prefix, compiled.grp->_key_prefix)) {
+            i = compiled.next;
+            continue;
+         }
+         count += format_items(buf, compiled, delimiter, filter);
+         ++i;
+      }
+      position = i < _compiled_groups.size() ? i : SIZE_MAX;
+      return count;
+   }
+
+   size_t group::prometheus_format_items(write_buffer& buf, const filter& filter)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      compile("");
+      compile_prometheus();
+      _prometheus_samples.clear();
+      _prometheus_ranges.clear();
+      const char* delimiter = "";
+      size_t count = 0;
+      size_t i = 0;
+      while (i < _compiled_groups.size()) {
+         auto& compiled = _compiled_groups[i];
+         if (not filter.may_match(compiled.key_prefix, compiled.grp->_key_prefix)) {
+            i = compiled.next;
+            continue;
+         }
+         count += format_items(_prometheus_samples, compiled, delimiter, filter, PROMETHEUS);
+         ++i;
+      }
+
+      // All samples of a metric family must be together, with the help and type lines once before them.
+      std::sort(_prometheus_ranges.begin(), _prometheus_ranges.end(),
+                [](const prometheus_range& a, const prometheus_range& b) {
+                   return a.family < b.family or (a.family == b.family and a.item < b.item);
+                });
+      auto& heads = _compiled_prometheus_heads;
+      size_t family = SIZE_MAX;
+      for (auto& range : _prometheus_ranges) {
+         if (range.family != family) {
+            auto& item = _compiled_items[range.item];
+            buf.append(heads.data() + item.prometheus_help_begin, item.prometheus_help_end - item.prometheus_help_begin);
+            family = range.family;
+         }
+         buf.append(_prometheus_samples.data() + range.begin, range.end - range.begin);
+      }
+      return count;
+   }
+
+   size_t group::binary_format_items(write_buffer& buf, const filter& filter, size_t& schema_size, bool schema)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      compile("");
+      if (schema) {
+         compile_binary();
+      }
+      _binary_types.clear();
+      _binary_values.clear();
+      auto schema_start = buf.size();
+      const char* delimiter = "";
+      size_t count = 0;
+      size_t i = 0;
+      while (i < _compiled_groups.size()) {
+         auto& compiled = _compiled_groups[i];
+         if (not filter.may_match(compiled.key_prefix, compiled.grp->_key_prefix)) {
+            i = compiled.next;
+            continue;
          }
+         count += format_items(buf, compiled, delimiter, filter, schema ? BINARY : BINARY_VALUES);
+         ++i;
+      }
+      schema_size = buf.size() - schema_start;
+      buf.append(_binary_types);
+      memset(buf.extend((8 - _binary_types.size() % 8) % 8), 0, (8 - _binary_types.size() % 8) % 8);
+      buf.append(_binary_values);
+      return count;
+   }
+
+   void group::compile(const std::string& key_prefix)
+   {
+      // Read changes before compiling, a change made while compiling will cause another compile next time.
+      auto changes = group::changes().load();
+      if (changes == _compiled_changes and key_prefix == _compiled_key_prefix) {
+         return;
+      }
+      _compiled_groups.clear();
+      _compiled_items.clear();
+      _compiled_heads.clear();
+      std::string prefix = key_prefix;
+      compile_group(*this, prefix);
+      _compiled_prometheus = false;
+      _compiled_binary = false;
+      _compiled_changes = changes;
+      _compiled_key_prefix = key_prefix;
+   }
+
+   void group::compile_group(group& group, std::string& key_prefix)
+   {
+      std::unique_lock<std::mutex> lock;
+      if (&group != this) {
+         lock = std::unique_lock<std::mutex>(group._mutex);
       }
       
-      auto escaped_key_prefix = escape_json(key_prefix);
+      auto index = _compiled_groups.size();
+      _compiled_groups.push_back({&group, key_prefix, _compiled_items.size(), 0, 0});
+      for (auto& value : group._values) {
+         auto head_begin = _compiled_heads.size();
+         _compiled_heads.append("{\"key\":\"");
+         json_escape(_compiled_heads, key_prefix);
+         _compiled_heads.append(value->item_spec);
+         _compiled_items.push_back({value.get(), head_begin, _compiled_heads.size(), 0, 0, 0, 0});
+      }
+      _compiled_groups[index].items_end = _compiled_items.size();
 
-      for (auto& value : _values) {
-         os << delimiter << "{\"key\":\"" << escaped_key_prefix << value->item_spec;
-         value->json_format(os);
-         os << "}";
-         delimiter = ",";
+      auto size = key_prefix.size();
+      for (auto& p : group._groups) {
+         key_prefix.append(group._key_prefix).append(p.first);
+         compile_group(*p.second, key_prefix);
+         key_prefix.resize(size);
+      }
+      _compiled_groups[index].next = _compiled_groups.size();
+   }
+   
+   void group::compile_prometheus()
+   {
+      if (_compiled_prometheus) {
+         return;
+      }
+      auto& heads = _compiled_prometheus_heads;
+      heads.clear();
+      write_buffer name;
+      std::map<std::string, size_t> families;
+      for (auto& compiled : _compiled_groups) {
+         for (auto i = compiled.items_begin; i < compiled.items_end; ++i) {
+            auto& item = _compiled_items[i];
+            auto& spec = item.val->prometheus;
+            item.prometheus_help_begin = item.prometheus_help_end = item.prometheus_begin = item.prometheus_end = 0;
+            item.prometheus_family = i;
+            if (not spec.type) {
+               continue;
+            }
+            
+            // Metric names can not start with a digit, leading _ are removed and put back if needed.
+            name.clear();
+            prometheus_name(name, compiled.key_prefix + item.val->key);
+            size_t start = 0;
+            while (start < name.size() and name.data()[start] == '_') {
+               ++start;
+            }
+            std::string metric(name.data() + start, name.size() - start);
+            metric.append(spec.suffix);
+            if (metric.empty() or isdigit(metric[0])) {
+               metric.insert(0, 1, '_');
+            }
+            item.prometheus_family = families.emplace(metric, i).first->second;
+
+            item.prometheus_help_begin = heads.size();
+            heads.append("# HELP ");
+            heads.append(metric);
+            heads.append(' ');
+            heads.append(spec.help);
+            heads.append("\n# TYPE ");
+            heads.append(metric);
+            heads.append(' ');
+            heads.append(spec.type);
+            heads.append('\n');
+            item.prometheus_help_end = heads.size();
+            
+            item.prometheus_begin = heads.size();
+            heads.append(metric);
+            if (not spec.family) {
+               heads.append(spec.labels);
+               heads.append(' ');
+            }
+            item.prometheus_end = heads.size();
+         }
+      }
+      _compiled_prometheus = true;
+   }
+   
+   void group::compile_binary()
+   {
+      if (_compiled_binary) {
+         return;
+      }
+      auto& heads = _compiled_binary_heads;
+      heads.clear();
+      std::string key;
+      for (auto& compiled : _compiled_groups) {
+         for (auto i = compiled.items_begin; i < compiled.items_end; ++i) {
+            auto& item = _compiled_items[i];
+            key = compiled.key_prefix + item.val->key + ':';
+            const char* delimiter = "";
+            for (auto& tag : item.val->tags) {
+               key.append(delimiter).append(tag);
+               delimiter = "-";
+            }
+            item.binary_begin = heads.size();
+            binary_append_u32(heads, uint32_t(key.size()));
+            heads.append(key);
+            heads.append(item.val->binary_spec);
+            item.binary_end = heads.size();
+         }
+      }
+      _compiled_binary = true;
+   }
+   
+   void group::batch_copy()
+   {
+      auto slot = _batch_snapshot.data();
+      for (auto& source : _batch_sources) {
+         switch (source.size) {
+            case 1: memcpy(slot, source.address, 1); break;
+            case 2: memcpy(slot, source.address, 2); break;
+            case 4: memcpy(slot, source.address, 4); break;
+            case 8: memcpy(slot, source.address, 8); break;
+         }
+         ++slot;
+      }
+   }
+   
+   size_t group::format_items(write_buffer& buf, const compiled_group& compiled, const char*& delimiter,
+                              const filter& filter, format_t format)
+   {
+      auto& group = *compiled.grp;
+      std::unique_lock<std::mutex> lock;
+      if (&group != this) {
+         lock = std::unique_lock<std::mutex>(group._mutex);
       }
 
-      for (auto& p : _groups) {
-         p.second->json_format_items(os, key_prefix + _key_prefix + p.first, delimiter);
+      auto begin = _compiled_items.begin() + ptrdiff_t(compiled.items_begin);
+      auto end = _compiled_items.begin() + ptrdiff_t(compiled.items_end);
+
+      // Select values and collect the values to prepare while locked before locking, to keep lock time short.
+      bool any_selected = false;
+      bool batch_selected = false;
+      _locked_prepare.clear();
+      for (auto it = begin; it != end; ++it) {
+         auto value = it->val;
+         value->selected = filter.matches(compiled.key_prefix, value->key, value->tags, value->level);
+         if (not value->selected) {
+            continue;
+         }
+         any_selected = true;
+         if (value->batched) {
+            batch_selected = true;
+         }
+         else if (value->needs_lock()) {
+            _locked_prepare.push_back(value);
+         }
+      }
+
+      if (not any_selected) {
+         return 0;
+      }
+      
+      auto now = std::chrono::steady_clock::now();
+      bool locked = true;
+      if (batch_selected or not _locked_prepare.empty()) {
+         std::unique_lock<std::mutex> value_lock;
+         if (group._value_mutex) {
+            auto wait_start = std::chrono::steady_clock::now();
+            if (group._try_lock) {
+               locked = group.try_lock_value_mutex(value_lock);
+               if (not locked) {
+                  lock_stats().try_lock_fail_count.fetch_add(1, std::memory_order_relaxed);
+                  if (group._lock_stats) {
+                     group._lock_stats->try_lock_fail_count.fetch_add(1, std::memory_order_relaxed);
+                  }
+               }
+            }
+            else {
+               value_lock = std::unique_lock<std::mutex>(*group._value_mutex);
+            }
+            auto wait_time = uint64_t(std::chrono::nanoseconds(std::chrono::steady_clock::now() - wait_start).count());
+            lock_stats().wait_time.record(wait_time);
+            if (group._lock_stats) {
+               group._lock_stats->wait_time.record(wait_time);
+            }
+         }
+
+         if (locked) {
+            auto lock_time = std::chrono::steady_clock::now();
+            if (batch_selected) {
+               group.batch_copy();
+            }
+            for (auto value : _locked_prepare) {
+               value->prepared_time = now;
+               value->locked_prepare();
+            }
+            if (value_lock) {
+               value_lock.unlock();
+               auto hold_time = std::chrono::nanoseconds(std::chrono::steady_clock::now() - lock_time).count();
+               lock_stats().hold_time.record(uint64_t(hold_time));
+               if (group._lock_stats) {
+                  group._lock_stats->hold_time.record(uint64_t(hold_time));
+               }
+            }
+         }
+      }
+      
+      size_t count = 0;
+      for (auto it = begin; it != end; ++it) {
+         auto value = it->val;
+         if (not value->selected) {
+            continue;
+         }
+         bool needs_lock = value->batched or value->needs_lock();
+         if (not needs_lock) {
+            value->prepared_time = now;
+            value->locked_prepare();
+         }
+         else if (locked and value->batched) {
+            value->prepared_time = now;
+         }
+         bool stale = not locked and needs_lock;
+         if (format == BINARY or format == BINARY_VALUES) {
+            // Values never read are included as none to keep the schema the same.
+            if (format == BINARY) {
+               buf.append(_compiled_binary_heads.data() + it->binary_begin, it->binary_end - it->binary_begin);
+            }
+            uint64_t bits = 0;
+            binary_type_t type = binary_type::NONE;
+            if (not stale or value->prepared_time != std::chrono::steady_clock::time_point()) {
+               if (value->binary_type != binary_type::NONE) {
+                  type = value->binary_type;
+                  bits = value->binary_bits();
+               }
+               else {
+                  _binary_value.clear();
+                  value->json_format(_binary_value);
+                  type = binary_value(_binary_value.data(), _binary_value.size(), bits);
+               }
+            }
+            _binary_types.append(char(type));
+            binary_append_u64(_binary_values, bits);
+            ++count;
+            continue;
+         }
+         if (stale and value->prepared_time == std::chrono::steady_clock::time_point()) {
+            continue;
+         }
+         if (format == PROMETHEUS) {
+            // Stale values are formatted as they are, there is no way to mark them.
+            auto& spec = value->prometheus;
+            if (not spec.type) {
+               continue;
+            }
+            auto start = buf.size();
+            auto& heads = _compiled_prometheus_heads;
+            if (spec.family) {
+               value->prometheus_format(buf, heads.data() + it->prometheus_begin,
+                                        it->prometheus_end - it->prometheus_begin);
+            }
+            else {
+               buf.append(heads.data() + it->prometheus_begin, it->prometheus_end - it->prometheus_begin);
+               auto value_start = buf.size();
+               value->json_format(buf);
+               if (not prometheus_value(buf, value_start)) {
+                  buf.truncate(start);
+                  continue;
+               }
+               buf.append('\n');
+            }
+            auto index = size_t(it - _compiled_items.begin());
+            _prometheus_ranges.push_back({it->prometheus_family, index, start, buf.size()});
+            ++count;
+            continue;
+         }
+         buf.append(delimiter);
+         if (_item_begins) {
+            _item_begins->push_back(buf.size());
+         }
+         buf.append(_compiled_heads.data() + it->head_begin, it->head_end - it->head_begin);
+         value->json_format(buf);
+         if (stale) {
+            buf.append(",\"stale\":true,\"age\":");
+            format_double(buf, std::chrono::duration<double>(now - value->prepared_time).count());
+         }
+         buf.append('}');
+         delimiter = ",";
+         ++count;
       }
+      return count;
    }  
 
    
@@ -0,0 +1,114 @@
+#include <cmath>
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+BOOST_AUTO_TEST_CASE(test_binary_value_converts_json_values_to_float64)
+{
+   uint64_t value;
+   double d;
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_value("12", 2, value));
+   memcpy(&d, &value, sizeof(d));
+   BOOST_CHECK_EQUAL(12, d);
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_value("-12", 3, value));
+   memcpy(&d, &value, sizeof(d));
+   BOOST_CHECK_EQUAL(-12, d);
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_value("true", 4, value));
+   memcpy(&d, &value, sizeof(d));
+   BOOST_CHECK_EQUAL(1, d);
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_value("1.5e-07", 7, value));
+   memcpy(&d, &value, sizeof(d));
+   BOOST_CHECK_EQUAL(1.5e-07, d);
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_value("nan", 3, value));
+   memcpy(&d, &value, sizeof(d));
+   BOOST_CHECK(std::isnan(d));
+   BOOST_CHECK_EQUAL(binary_type::NONE, binary_value("\"str\"", 5, value));
+   BOOST_CHECK_EQUAL(binary_type::NONE, binary_value("{\"a\":1}", 7, value));
+   BOOST_CHECK_EQUAL(binary_type::NONE, binary_value("", 0, value));
+   BOOST_CHECK_EQUAL(0, value);
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_type_of_follows_cpp_type)
+{
+   BOOST_CHECK_EQUAL(binary_type::UINT64, binary_type_of<bool>());
+   BOOST_CHECK_EQUAL(binary_type::UINT64, binary_type_of<uint64_t>());
+   BOOST_CHECK_EQUAL(binary_type::INT64, binary_type_of<int8_t>());
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, binary_type_of<float>());
+   BOOST_CHECK_EQUAL(binary_type::NONE, binary_type_of<char>());
+   BOOST_CHECK_EQUAL(binary_type::NONE, binary_type_of<string>());
+   BOOST_CHECK_EQUAL(18446744073709551615ull, binary_bits_of(uint64_t(18446744073709551615ull)));
+   BOOST_CHECK_EQUAL(-2, int64_t(binary_bits_of(int16_t(-2))));
+}
+
+BOOST_AUTO_TEST_CASE(test_group_binary_format_items_writes_schema_types_and_values)
+{
+   uint32_t a = 3;
+   int16_t b = -2;
+   string str = "str";
+   group root;
+   auto child = make_shared<group>("/child");
+   root.add_group(child);
+   child->add(&a, "/a", {tag::COUNT}, 1, "A.");
+   child->add(&b, "/b", {}, 2, "");
+   child->add(&str, "/str", {}, 3, "S");
+
+   write_buffer buf;
+   size_t schema_size;
+   auto items = root.binary_format_items(buf, glo::filter(), schema_size);
+
+   BOOST_REQUIRE_EQUAL(3, items);
+   BOOST_REQUIRE_EQUAL(schema_size + 8 + 3 * 8, buf.size());
+   
+   auto p = buf.data();
+   BOOST_REQUIRE_EQUAL(14, binary_read_u32(p));
+   BOOST_CHECK_EQUAL("/child/a:count", string(p + 4, 14));
+   BOOST_CHECK_EQUAL(1, binary_read_u32(p + 18));
+   BOOST_CHECK_EQUAL(2, binary_read_u32(p + 22));
+   BOOST_CHECK_EQUAL("A.", string(p + 26, 2));
+   BOOST_CHECK_EQUAL(9, binary_read_u32(p + 28));
+   BOOST_CHECK_EQUAL("/child/b:", string(p + 32, 9));
+
+   auto types = p + schema_size;
+   BOOST_CHECK_EQUAL(binary_type::UINT64, types[0]);
+   BOOST_CHECK_EQUAL(binary_type::INT64, types[1]);
+   BOOST_CHECK_EQUAL(binary_type::NONE, types[2]);
+   BOOST_CHECK_EQUAL(0, types[3]);
+   auto values = types + 8;
+   BOOST_CHECK_EQUAL(3, binary_read_u64(values));
+   BOOST_CHECK_EQUAL(-2, int64_t(binary_read_u64(values + 8)));
+   BOOST_CHECK_EQUAL(0, binary_read_u64(values + 16));
+}
+
+BOOST_AUTO_TEST_CASE(test_group_binary_format_items_types_do_not_depend_on_values)
+{
+   double d = 2;
+   int64_t i = 3;
+   atomic<float> f{0.5};
+   group root;
+   root.add(&d, "/d", {}, 0, "");
+   root.add(&i, "/i", {}, 0, "");
+   root.add(&f, "/f", {}, 0, "");
+
+   write_buffer buf;
+   size_t schema_size;
+   BOOST_REQUIRE_EQUAL(3, root.binary_format_items(buf, glo::filter(), schema_size));
+
+   auto types = buf.data() + schema_size;
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, types[0]);
+   BOOST_CHECK_EQUAL(binary_type::INT64, types[1]);
+   BOOST_CHECK_EQUAL(binary_type::FLOAT64, types[2]);
+   auto values = types + 8;
+   double read;
+   auto bits = binary_read_u64(values);
+   memcpy(&read, &bits, sizeof(read));
+   BOOST_CHECK_EQUAL(2, read);
+   BOOST_CHECK_EQUAL(3, binary_read_u64(values + 8));
+   bits = binary_read_u64(values + 16);
+   memcpy(&read, &bits, sizeof(read));
+   BOOST_CHECK_EQUAL(0.5, read);
+}
@@ -1,4 +1,5 @@
 #include <atomic>
+#include <future>
 #include <boost/test/unit_test.hpp>
 #include <boost/throw_exception.hpp>
 #include "glo.hpp"
@@ -68,14 +69,38 @@ BOOST_AUTO_TEST_CASE(test_cref_to_bool_uses_copy_while_locked_implementation)
    g.json_format_items(ss, "", delimiter);
 }
 
-BOOST_AUTO_TEST_CASE(test_pointer_to_atomic_uint8_uses_formaat_while_locked_implementation)
+BOOST_AUTO_TEST_CASE(test_pointer_to_atomic_uint8_uses_lock_free_implementation)
 {
    atomic<uint8_t> val(10);
    group g(group_lock_test_mutex);
    g.add<decltype(&val), locking_formatter<decltype(&val)>>(&val, "", {}, 0, "");
    stringstream ss;
    const char* delimiter = "";
-   BOOST_CHECK_THROW(g.json_format_items(ss, "", delimiter), locked_exception);
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK(ss.str().find("\"value\":10}") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_cref_to_atomic_int64_uses_lock_free_implementation)
+{
+   atomic<int64_t> val(-10);
+   auto ref = cref(val);
+   group g(group_lock_test_mutex);
+   g.add<decltype(ref), locking_formatter<decltype(ref)>>(ref, "", {}, 0, "");
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK(ss.str().find("\"value\":-10}") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_ptr_to_atomic_bool_uses_lock_free_implementation)
+{
+   auto val = make_shared<atomic<bool>>(true);
+   group g(group_lock_test_mutex);
+   g.add<decltype(val), locking_formatter<decltype(val)>>(val, "", {}, 0, "");
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK(ss.str().find("\"value\":true}") != string::npos);
 }
  
 BOOST_AUTO_TEST_CASE(test_shared_ptr_to_int8_uses_copy_while_locked_implementation)
@@ -90,3 +115,151 @@ BOOST_AUTO_TEST_CASE(test_shared_ptr_to_int8_uses_copy_while_locked_implementati
 
 
 
+BOOST_AUTO_TEST_CASE(test_filtered_out_value_is_not_formatted_while_locked)
+{
+   string val = "str";
+   group g(group_lock_test_mutex);
+   g.add<decltype(&val), locking_formatter<decltype(&val)>>(&val, "", {}, level::LOW, "");
+   stringstream ss;
+   const char* delimiter = "";
+   glo::filter filter;
+   filter.max_level = level::HIGH;
+   g.json_format_items(ss, "", delimiter, filter);
+   BOOST_CHECK_EQUAL("", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_filtered_out_group_does_not_lock_mutex)
+{
+   uint32_t val = 10;
+   auto g = make_shared<group>("/locked", group_lock_test_mutex);
+   g->add(&val, "/val", {}, 0, "");
+   group root;
+   root.add_group(g);
+   
+   std::lock_guard<std::mutex> lock(*group_lock_test_mutex);
+   auto result = std::async(std::launch::async, [&root]() {
+         stringstream ss;
+         const char* delimiter = "";
+         glo::filter filter;
+         filter.key_prefix = "/other";
+         root.json_format_items(ss, "", delimiter, filter);
+         return ss.str();
+      });
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   BOOST_CHECK_EQUAL("", result.get());
+}
+
+
+BOOST_AUTO_TEST_CASE(test_group_with_only_atomics_does_not_lock_mutex)
+{
+   atomic<uint32_t> val(10);
+   group g(group_lock_test_mutex);
+   g.add(&val, "/val", {}, 0, "");
+   
+   std::lock_guard<std::mutex> lock(*group_lock_test_mutex);
+   auto result = std::async(std::launch::async, [&g]() {
+         stringstream ss;
+         const char* delimiter = "";
+         g.json_format_items(ss, "", delimiter);
+         return ss.str();
+      });
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   BOOST_CHECK(result.get().find("\"value\":10}") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_try_lock_serves_stale_values_when_mutex_is_locked)
+{
+   string val = "a";
+   group g(group_lock_test_mutex);
+   g.set_try_lock();
+   g.add(&val, "/val", {}, 0, "");
+   g.add(&val, "/never_read", {}, level::LOW, "");
+
+   auto format = [&g](level_t max_level) {
+      stringstream ss;
+      const char* delimiter = "";
+      glo::filter filter;
+      filter.max_level = max_level;
+      g.json_format_items(ss, "", delimiter, filter);
+      return ss.str();
+   };
+   
+   BOOST_CHECK_EQUAL(R""({"key":"/val:","level":0,"desc":"","value":"a"})"", format(level::HIGHEST));
+   
+   std::lock_guard<std::mutex> lock(*group_lock_test_mutex);
+   val = "b";
+   auto result = std::async(std::launch::async, format, level::LOWEST);
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   auto str = result.get();
+   BOOST_CHECK_EQUAL(0, str.find(R""({"key":"/val:","level":0,"desc":"","value":"a","stale":true,"age":)""));
+   BOOST_CHECK_EQUAL(string::npos, str.find("never_read"));
+}
+
+BOOST_AUTO_TEST_CASE(test_try_lock_with_timeout_gives_up_after_timeout)
+{
+   uint32_t val = 1;
+   group g(group_lock_test_mutex);
+   g.set_try_lock(20ms);
+   g.add(&val, "/val", {}, 0, "");
+   
+   std::lock_guard<std::mutex> lock(*group_lock_test_mutex);
+   auto start = chrono::steady_clock::now();
+   auto result = std::async(std::launch::async, [&g]() {
+         stringstream ss;
+         const char* delimiter = "";
+         g.json_format_items(ss, "", delimiter);
+         return ss.str();
+      });
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   BOOST_CHECK(chrono::steady_clock::now() - start >= 20ms);
+   BOOST_CHECK_EQUAL("", result.get());
+}
+
+BOOST_AUTO_TEST_CASE(test_batched_fundamental_values_are_copied_while_locked)
+{
+   uint8_t u8 = 8;
+   int16_t i16 = -16;
+   auto f = make_shared<float>(0.5f);
+   double d = 1.5;
+   bool b = true;
+   group g(group_lock_test_mutex);
+   g.add<decltype(&u8), locking_formatter<decltype(&u8)>>(&u8, "/u8", {}, 0, "");
+   g.add(cref(i16), "/i16", {}, 0, "");
+   g.add(f, "/f", {}, 0, "");
+   g.add(&d, "/d", {}, 0, "");
+   g.add(ref(b), "/b", {}, 0, "");
+   auto hold_count = lock_stats().hold_time.count();
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK_EQUAL(R""({"key":"/u8:","level":0,"desc":"","value":8},)""
+                     R""({"key":"/i16:","level":0,"desc":"","value":-16},)""
+                     R""({"key":"/f:","level":0,"desc":"","value":0.5},)""
+                     R""({"key":"/d:","level":0,"desc":"","value":1.5},)""
+                     R""({"key":"/b:","level":0,"desc":"","value":true})"", ss.str());
+   BOOST_CHECK_EQUAL(hold_count + 1, lock_stats().hold_time.count());
+}
+
+BOOST_AUTO_TEST_CASE(test_group_lock_stats_are_recorded_per_group)
+{
+   uint32_t a = 1;
+   uint32_t b = 2;
+   group g1(group_lock_test_mutex);
+   group g2(group_lock_test_mutex);
+   g1.add(&a, "/a", {}, 0, "");
+   g2.add(&b, "/b", {}, 0, "");
+   g1.add_lock_stats("/lock");
+   auto wait_count = lock_stats().wait_time.count();
+   write_buffer buf;
+   const char* delimiter = "";
+   g2.json_format_items(buf, "", delimiter, filter());
+   buf.clear();
+   delimiter = "";
+   auto count = g1.json_format_items(buf, "", delimiter, filter());
+   BOOST_CHECK_EQUAL(1 + 8 + 8 + 1, count);
+   BOOST_CHECK(buf.str().find(R""({"key":"/lock/hold:duration-count","level":3,"desc":"Time in ns the value mutex)"") !=
+               string::npos);
+   BOOST_CHECK(buf.str().find(R""(duration-count","level":3,"desc":"Time in ns waiting to lock the value mutex of)""
+                              R""( the group.","value":1})"") != string::npos);
+   BOOST_CHECK_EQUAL(wait_count + 2, lock_stats().wait_time.count());
+}
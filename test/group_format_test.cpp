@@ -1,4 +1,5 @@
 #include <atomic>
+#include <thread>
 #include <boost/test/unit_test.hpp>
 #include <boost/throw_exception.hpp>
 
@@ -8,6 +9,32 @@ using namespace glo;
 using namespace std;
 
 
+// Count allocations to be able to check that formatting does not allocate. Only counted by the thread calling
+// count_allocations while the call is made, other tests are not affected.
+static thread_local bool counting_allocations = false;
+static thread_local uint64_t allocation_count = 0;
+
+void* operator new(size_t size)
+{
+   if (counting_allocations) ++allocation_count;
+   if (void* p = malloc(size ? size : 1)) return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Returns the number of allocations made by this thread when calling f.
+template<typename F> uint64_t count_allocations(F f)
+{
+   allocation_count = 0;
+   counting_allocations = true;
+   f();
+   counting_allocations = false;
+   return allocation_count;
+}
+
+
 BOOST_AUTO_TEST_CASE(test_format_pointer_to_updating_string)
 {
    string val = "str";
@@ -162,3 +189,196 @@ BOOST_AUTO_TEST_CASE(test_json_format)
       BOOST_CHECK_EQUAL("false", ss.str());
    }
 }
+
+BOOST_AUTO_TEST_CASE(test_format_with_filter)
+{
+   uint32_t a = 1;
+   uint32_t b = 2;
+   uint32_t c = 3;
+   auto child = make_shared<group>("/child");
+   child->add(&c, "/c", {tag::SIZE}, level::LOW, "C.");
+   group g("/g");
+   g.add(&a, "/a", {tag::COUNT}, level::HIGH, "A.");
+   g.add(&b, "/b", {tag::LAST, tag::COUNT}, level::LOW, "B.");
+   g.add_group(child);
+
+   auto format = [&g](const glo::filter& filter) {
+      stringstream ss;
+      const char* delimiter = "";
+      g.json_format_items(ss, "", delimiter, filter);
+      return ss.str();
+   };
+
+   {
+      glo::filter filter;
+      filter.max_level = level::HIGH;
+      BOOST_CHECK_EQUAL(R""({"key":"/g/a:count","level":1,"desc":"A.","value":1})"", format(filter));
+   }
+   {
+      glo::filter filter;
+      filter.key_prefix = "/g/child";
+      BOOST_CHECK_EQUAL(R""({"key":"/g/child/c:size","level":3,"desc":"C.","value":3})"", format(filter));
+   }
+   {
+      glo::filter filter;
+      filter.tag = tag::LAST;
+      BOOST_CHECK_EQUAL(R""({"key":"/g/b:last-count","level":3,"desc":"B.","value":2})"", format(filter));
+   }
+   {
+      glo::filter filter;
+      filter.key_prefix = "/x";
+      BOOST_CHECK_EQUAL("", format(filter));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_format_numbers_to_write_buffer)
+{
+   auto format = [](auto value) {
+      write_buffer buf;
+      json_format(buf, value);
+      return buf.str();
+   };
+   
+   BOOST_CHECK_EQUAL("0", format(uint64_t(0)));
+   BOOST_CHECK_EQUAL("18446744073709551615", format(std::numeric_limits<uint64_t>::max()));
+   BOOST_CHECK_EQUAL("-9223372036854775808", format(std::numeric_limits<int64_t>::min()));
+   BOOST_CHECK_EQUAL("-12", format(int8_t(-12)));
+   BOOST_CHECK_EQUAL("255", format(uint8_t(255)));
+   BOOST_CHECK_EQUAL("3", format(3.0));
+   BOOST_CHECK_EQUAL("-0.5", format(-0.5));
+   BOOST_CHECK_EQUAL("1500000000.25", format(1500000000.25));
+   BOOST_CHECK_EQUAL("true", format(true));
+   BOOST_CHECK_EQUAL("\"a\\u000ab\"", format("a\nb"s));
+}
+
+BOOST_AUTO_TEST_CASE(test_format_to_write_buffer_does_not_allocate_when_warm)
+{
+   uint32_t a = 1;
+   string b = "str";
+   atomic<uint8_t> c(3);
+   auto child = make_shared<group>("/child/with/a/long/prefix");
+   child->add(&c, "/c", {tag::COUNT}, 0, "C.");
+   group g("/g");
+   g.add(&a, "/a", {tag::COUNT}, 0, "A.");
+   g.add(&b, "/b", {tag::LAST}, 0, "B.");
+   g.add_group(child, "/and/some/more/prefix");
+   
+   write_buffer buf;
+   auto format = [&g, &buf]() {
+      buf.clear();
+      const char* delimiter = "";
+      g.json_format_items(buf, "", delimiter, glo::filter());
+   };
+   
+   format();
+   BOOST_CHECK_EQUAL(0, count_allocations(format));
+   BOOST_CHECK_EQUAL(R""({"key":"/g/a:count","level":0,"desc":"A.","value":1},)""
+                     R""({"key":"/g/b:last","level":0,"desc":"B.","value":"str"},)""
+                     R""({"key":"/g/and/some/more/prefix/child/with/a/long/prefix/c:count","level":0,"desc":"C.","value":3})"",
+                     buf.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_format_callback_value)
+{
+   uint32_t calls = 0;
+   group g;
+   g.add_cb([&calls]() { return ++calls; }, "/calls", {tag::COUNT}, 0, "Calls.");
+   g.add_cb(std::function<std::string()>([]() { return "str"; }), "/str", {}, 0, "");
+   auto duration_count = callback_stats().duration.count();
+   for (uint32_t i = 1; i <= 2; ++i) {
+      stringstream ss;
+      const char* delimiter = "";
+      g.json_format_items(ss, "", delimiter);
+      BOOST_CHECK_EQUAL(R""({"key":"/calls:count","level":0,"desc":"Calls.","value":)"" + to_string(i) + "},"
+                        R""({"key":"/str:","level":0,"desc":"","value":"str"})"", ss.str());
+   }
+   BOOST_CHECK_EQUAL(duration_count + 4, callback_stats().duration.count());
+}
+
+BOOST_AUTO_TEST_CASE(test_callback_value_is_cached_within_refresh_interval)
+{
+   uint32_t calls = 0;
+   group g;
+   g.add_cb([&calls]() { return ++calls; }, "/calls", {}, 0, "", 10s);
+   for (uint32_t i = 0; i < 3; ++i) {
+      stringstream ss;
+      const char* delimiter = "";
+      g.json_format_items(ss, "", delimiter);
+      BOOST_CHECK_EQUAL(R""({"key":"/calls:","level":0,"desc":"","value":1})"", ss.str());
+   }
+   BOOST_CHECK_EQUAL(1, calls);
+}
+
+BOOST_AUTO_TEST_CASE(test_slow_callback_is_counted)
+{
+   group g;
+   g.add_cb([]() { this_thread::sleep_for(2 * CALLBACK_SLOW_TIME); return 1; }, "/slow", {}, 0, "");
+   auto slow_count = callback_stats().slow_count.load();
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK_EQUAL(slow_count + 1, callback_stats().slow_count.load());
+}
+
+BOOST_AUTO_TEST_CASE(test_callback_over_budget_is_counted_under_its_key)
+{
+   group g;
+   g.add_cb([]() { this_thread::sleep_for(1ms); return 1; }, "/x", {}, 0, "", 0ns, 1ns);
+   g.add_cb([]() { return 2; }, "/y", {}, 0, "", 0ns, 1h);
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   auto json = ss.str();
+   BOOST_CHECK(json.find(R""({"key":"/x/callback/slow:count","level":0,"desc":"Calls of the callback taking longer than )""
+                         R""(its budget.","value":1})"") != string::npos);
+   BOOST_CHECK(json.find(R""({"key":"/y/callback/slow:count","level":0,"desc":"Calls of the callback taking longer than )""
+                         R""(its budget.","value":0})"") != string::npos);
+   BOOST_CHECK(json.find(R""({"key":"/x/callback:duration-count","level":0,"desc":"Time in ns calling the callback.",)""
+                         R""("value":1})"") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_format_sees_values_and_groups_added_after_first_format)
+{
+   uint32_t a = 1;
+   uint32_t b = 2;
+   uint32_t c = 3;
+   group root("/root");
+   auto child = make_shared<group>("/child");
+   child->add(&a, "/a", {}, 0, "");
+   root.add_group(child, "/p");
+   auto format = [&root]() {
+      stringstream ss;
+      const char* delimiter = "";
+      root.json_format_items(ss, "/x", delimiter);
+      return ss.str();
+   };
+   BOOST_CHECK_EQUAL(R""({"key":"/x/root/p/child/a:","level":0,"desc":"","value":1})"", format());
+
+   child->add(&b, "/b", {}, 0, "");
+   auto grandchild = make_shared<group>("/grandchild");
+   grandchild->add(&c, "/c", {}, 0, "");
+   child->add_group(grandchild);
+   BOOST_CHECK_EQUAL(R""({"key":"/x/root/p/child/a:","level":0,"desc":"","value":1},)""
+                     R""({"key":"/x/root/p/child/b:","level":0,"desc":"","value":2},)""
+                     R""({"key":"/x/root/p/child/grandchild/c:","level":0,"desc":"","value":3})"", format());
+}
+
+BOOST_AUTO_TEST_CASE(test_format_deep_hierarchy)
+{
+   uint32_t val = 7;
+   group root;
+   auto parent = make_shared<group>("/g");
+   root.add_group(parent);
+   for (uint32_t i = 0; i < 1000; ++i) {
+      auto child = make_shared<group>("/g");
+      child->add(&val, "/v", {}, 0, "");
+      parent->add_group(child);
+      parent = child;
+   }
+   stringstream ss;
+   const char* delimiter = "";
+   glo::filter filter;
+   filter.key_prefix = "/g/g/g/v";
+   root.json_format_items(ss, "", delimiter, filter);
+   BOOST_CHECK_EQUAL(R""({"key":"/g/g/g/v:","level":0,"desc":"","value":7})"", ss.str());
+}
@@ -0,0 +1,98 @@
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+BOOST_AUTO_TEST_CASE(test_histogram_buckets_cover_all_values_with_bounded_error)
+{
+   BOOST_CHECK_EQUAL(0, histogram::bucket_index(0));
+   BOOST_CHECK_EQUAL(HISTOGRAM_BUCKETS - 1, histogram::bucket_index(numeric_limits<uint64_t>::max()));
+   BOOST_CHECK_EQUAL(numeric_limits<uint64_t>::max(), histogram::bucket_max(HISTOGRAM_BUCKETS - 1));
+
+   for (uint64_t value : {uint64_t(1), uint64_t(31), uint64_t(32), uint64_t(33), uint64_t(1000), uint64_t(123456789),
+            uint64_t(1) << 40, (uint64_t(1) << 40) - 1, uint64_t(1) << 63}) {
+      auto index = histogram::bucket_index(value);
+      BOOST_CHECK(value <= histogram::bucket_max(index));
+      BOOST_CHECK(index == 0 or histogram::bucket_max(index - 1) < value);
+      BOOST_CHECK(double(histogram::bucket_max(index) - value) <= double(value) / HISTOGRAM_SUB_BUCKETS);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram_statistics)
+{
+   histogram h;
+   BOOST_CHECK_EQUAL(0, h.count());
+   BOOST_CHECK_EQUAL(0, h.min());
+   BOOST_CHECK_EQUAL(0, h.percentile(0.5));
+   
+   for (uint64_t i = 1; i <= 1000; ++i) {
+      h.record(i);
+   }
+   BOOST_CHECK_EQUAL(1000, h.count());
+   BOOST_CHECK_EQUAL(1, h.min());
+   BOOST_CHECK_EQUAL(1000, h.max());
+   BOOST_CHECK_EQUAL(500.5, h.mean());
+   BOOST_CHECK_EQUAL(1, h.percentile(0));
+   BOOST_CHECK_EQUAL(1000, h.percentile(1));
+   BOOST_CHECK(500 <= h.percentile(0.5) and h.percentile(0.5) <= 500 + 500 / HISTOGRAM_SUB_BUCKETS);
+   BOOST_CHECK(990 <= h.percentile(0.99) and h.percentile(0.99) <= 1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram_record_from_many_threads)
+{
+   histogram h;
+   vector<thread> threads;
+   for (uint64_t i = 1; i <= 8; ++i) {
+      threads.emplace_back([&h, i]() {
+            for (uint32_t j = 0; j < 10000; ++j) {
+               h.record(i * 100);
+            }
+         });
+   }
+   for (auto& t : threads) {
+      t.join();
+   }
+   BOOST_CHECK_EQUAL(80000, h.count());
+   BOOST_CHECK_EQUAL(100, h.min());
+   BOOST_CHECK_EQUAL(800, h.max());
+   BOOST_CHECK_EQUAL(450 * 80000, h.sum());
+}
+
+BOOST_AUTO_TEST_CASE(test_format_histogram_as_items_tagged_duration)
+{
+   histogram h;
+   h.record(10);
+   h.record(20);
+   group g;
+   g.add(&h, "/latency", {}, 0, "Latency.");
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK_EQUAL(R""({"key":"/latency:duration-count","level":0,"desc":"Latency.","value":2},)""
+                     R""({"key":"/latency:duration-min","level":0,"desc":"Latency.","value":10},)""
+                     R""({"key":"/latency:duration-max","level":0,"desc":"Latency.","value":20},)""
+                     R""({"key":"/latency:duration-mean","level":0,"desc":"Latency.","value":15},)""
+                     R""({"key":"/latency:duration-p50","level":0,"desc":"Latency.","value":10},)""
+                     R""({"key":"/latency:duration-p90","level":0,"desc":"Latency.","value":20},)""
+                     R""({"key":"/latency:duration-p99","level":0,"desc":"Latency.","value":20},)""
+                     R""({"key":"/latency:duration-p999","level":0,"desc":"Latency.","value":20})"", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_filter_histogram_items_by_tag)
+{
+   auto h = make_shared<histogram>();
+   h->record(1000);
+   group g;
+   g.add(h, "/latency", {}, 0, "");
+   stringstream ss;
+   const char* delimiter = "";
+   glo::filter filter;
+   filter.tag = tag::P99;
+   g.json_format_items(ss, "", delimiter, filter);
+   BOOST_CHECK_EQUAL(R""({"key":"/latency:duration-p99","level":0,"desc":"","value":1000})"", ss.str());
+}
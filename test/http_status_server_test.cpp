@@ -66,6 +66,28 @@ http_response request(uint16_t port, std::string data)
     return http_response(response);
 }
 
+http_response request_unix(std::string path, std::string data)
+{
+    boost::system::error_code ec;
+    using namespace boost::asio;
+
+    if (path[0] == '@') path[0] = '\0';
+    
+    io_service svc;
+    local::stream_protocol::socket sock(svc);
+    sock.connect(local::stream_protocol::endpoint(path));
+    sock.send(buffer(data));
+
+    std::string response;
+    do {
+        char buf[1024];
+        auto recieved = sock.receive(buffer(buf), {}, ec);
+        if (!ec) response.append(buf, buf + recieved);
+    } while (!ec);
+
+    return http_response(response);
+}
+
 
 BOOST_AUTO_TEST_CASE(basic_serve_once_test)
 {
@@ -112,3 +134,535 @@ BOOST_AUTO_TEST_CASE(test_serve_once_timeouts_on_no_request)
    BOOST_CHECK(duration > 5us);
 }
 
+BOOST_AUTO_TEST_CASE(test_stop_wakes_up_idle_server)
+{
+   http_status_server server;
+   server.start(0ms);
+   std::this_thread::sleep_for(10ms);
+   auto before = std::chrono::high_resolution_clock::now();
+   server.stop();
+   auto duration = std::chrono::high_resolution_clock::now() - before;
+   BOOST_CHECK(duration < 100ms);
+}
+
+BOOST_AUTO_TEST_CASE(test_slow_client_does_not_stall_other_clients)
+{
+   http_status_server server;
+   server.start(0ms);
+
+   using namespace boost::asio;
+   io_service svc;
+   ip::tcp::socket slow(svc);
+   slow.connect({ {}, server.port() });
+   slow.send(buffer("GET / HTTP/1.1\r\n"s));
+   
+   auto before = std::chrono::high_resolution_clock::now();
+   auto response = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto duration = std::chrono::high_resolution_clock::now() - before;
+
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", response.status());
+   BOOST_CHECK(duration < 500ms);
+
+   server.stop();
+}
+
+BOOST_AUTO_TEST_CASE(test_pipelined_requests_on_keep_alive_connection)
+{
+   uint16_t var = 1;
+   http_status_server server;
+   server.add(&var, "/val", {tag::COUNT}, 0, "A value.");
+   server.start(0ms);
+
+   auto response = request(server.port(), "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+   server.stop();
+   
+   auto second = response.raw.find("HTTP/1.1 200 OK", 1);
+   BOOST_REQUIRE(second != string::npos);
+   
+   http_response first_response(response.raw.substr(0, second));
+   http_response second_response(response.raw.substr(second));
+   
+   BOOST_CHECK(first_response.raw.find("Connection: keep-alive\r\n") != string::npos);
+   BOOST_CHECK(second_response.raw.find("Connection: close\r\n") != string::npos);
+   BOOST_CHECK_EQUAL(1, first_response.json()["items"].Size());
+   BOOST_CHECK_EQUAL(1, second_response.json()["items"].Size());
+}
+
+BOOST_AUTO_TEST_CASE(test_pipelined_request_after_closing_response_is_not_answered)
+{
+   uint16_t var = 1;
+   http_status_server server;
+   server.add(&var, "/val", {tag::COUNT}, 0, "A value.");
+   server.start(0ms);
+
+   auto closed = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+   auto bad = request(server.port(), "PUT / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+
+   server.stop();
+
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", closed.status());
+   BOOST_CHECK_EQUAL(string::npos, closed.raw.find("HTTP/1.1", 1));
+   BOOST_CHECK_EQUAL("HTTP/1.1 400 only get is supported", bad.status());
+   BOOST_CHECK_EQUAL(string::npos, bad.raw.find("HTTP/1.1", 1));
+}
+
+BOOST_AUTO_TEST_CASE(test_large_jsonp_response_is_sent_completely)
+{
+   vector<uint32_t> values(20000, 7);
+   http_status_server server;
+   for (size_t i = 0; i < values.size(); ++i) {
+      server.add(&values[i], "/val/" + to_string(i), {tag::COUNT}, 0, "A value with a description.");
+   }
+   server.start(0ms);
+
+   auto response = request(server.port(), "GET /?callback=cb HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+   server.stop();
+
+   auto data = response.data();
+   auto length_pos = response.raw.find("Content-Length: ") + 16;
+   BOOST_CHECK_EQUAL(data.size(), stoul(response.raw.substr(length_pos, response.raw.find("\r\n", length_pos))));
+   BOOST_CHECK(data.size() > 1000000);
+   BOOST_CHECK_EQUAL("cb({", data.substr(0, 4));
+   BOOST_CHECK_EQUAL("});", data.substr(data.size() - 3));
+}
+
+// Decode a chunked body, returns the data and the number of chunks (the last empty chunk included).
+pair<string, size_t> dechunk(const string& body)
+{
+   string data;
+   size_t chunks = 0;
+   size_t pos = 0;
+   while (pos < body.size()) {
+      auto line_end = body.find("\r\n", pos);
+      auto size = stoul(body.substr(pos, line_end - pos), nullptr, 16);
+      data.append(body, line_end + 2, size);
+      pos = line_end + 2 + size + 2;
+      ++chunks;
+      if (size == 0) break;
+   }
+   return {data, chunks};
+}
+
+BOOST_AUTO_TEST_CASE(test_streaming_response_is_sent_in_chunks)
+{
+   vector<uint32_t> values(100, 7);
+   http_status_server server;
+   for (size_t i = 0; i < values.size(); ++i) {
+      auto g = make_shared<group>("/group/" + to_string(i));
+      g->add(&values[i], "/val", {tag::COUNT}, 0, "A value.");
+      server.add_group(g);
+   }
+   server.set_streaming(1024);
+   server.start(0ms);
+
+   auto response = request(server.port(), "GET / HTTP/1.1\r\n\r\nGET /?callback=cb HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+   server.stop();
+
+   auto second = response.raw.find("HTTP/1.1 200 OK", 1);
+   BOOST_REQUIRE(second != string::npos);
+   http_response first(response.raw.substr(0, second));
+   http_response jsonp(response.raw.substr(second));
+   
+   BOOST_CHECK(first.raw.find("Transfer-Encoding: chunked\r\n") != string::npos);
+   BOOST_CHECK(first.raw.find("Content-Length:") == string::npos);
+   auto decoded = dechunk(first.data());
+   BOOST_CHECK(decoded.second > 2);
+   json::Document doc;
+   doc.Parse(decoded.first.c_str());
+   BOOST_REQUIRE_EQUAL(100, doc["items"].Size());
+   BOOST_CHECK_EQUAL("/group/99/val:count", doc["items"][99]["key"].GetString());
+
+   auto jsonp_data = dechunk(jsonp.data()).first;
+   BOOST_CHECK_EQUAL("cb({", jsonp_data.substr(0, 4));
+   BOOST_CHECK_EQUAL("]});", jsonp_data.substr(jsonp_data.size() - 4));
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_is_reused_within_max_age)
+{
+   http_status_server server;
+   server.start(10s);
+
+   auto timestamp1 = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json()["timestamp"].GetDouble();
+   auto timestamp2 = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json()["timestamp"].GetDouble();
+   
+   server.stop();
+
+   BOOST_CHECK_EQUAL(timestamp1, timestamp2);
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_is_not_reused_after_max_age)
+{
+   http_status_server server;
+   server.start(0ms);
+
+   auto timestamp1 = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json()["timestamp"].GetDouble();
+   std::this_thread::sleep_for(1ms);
+   auto timestamp2 = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json()["timestamp"].GetDouble();
+   
+   server.stop();
+
+   BOOST_CHECK(timestamp1 < timestamp2);
+}
+
+BOOST_AUTO_TEST_CASE(test_filter_by_request_parameters)
+{
+   uint16_t a = 1;
+   uint16_t b = 2;
+   http_status_server server;
+   server.add(&a, "/cache/a", {tag::COUNT}, level::HIGH, "A.");
+   server.add(&b, "/other/b", {tag::SIZE}, level::LOW, "B.");
+   server.start(0ms);
+
+   auto by_level = request(server.port(), "GET /?level=1 HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   auto by_prefix = request(server.port(), "GET /?prefix=%2Fother HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   auto by_tag = request(server.port(), "GET /?tag=count&level=3 HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   auto bad = request(server.port(), "GET /?level=x HTTP/1.1\r\nConnection: close\r\n\r\n");
+   
+   server.stop();
+
+   BOOST_REQUIRE_EQUAL(1, by_level["items"].Size());
+   BOOST_CHECK_EQUAL("/cache/a:count", by_level["items"][0]["key"].GetString());
+   BOOST_REQUIRE_EQUAL(1, by_prefix["items"].Size());
+   BOOST_CHECK_EQUAL("/other/b:size", by_prefix["items"][0]["key"].GetString());
+   BOOST_REQUIRE_EQUAL(1, by_tag["items"].Size());
+   BOOST_CHECK_EQUAL("/cache/a:count", by_tag["items"][0]["key"].GetString());
+   BOOST_CHECK_EQUAL("HTTP/1.1 400 bad level", bad.status());
+}
+
+
+BOOST_AUTO_TEST_CASE(test_server_statistics_are_served_after_add_statistics)
+{
+   uint32_t a = 1;
+   http_status_server server;
+   server.add(&a, "/a", {tag::COUNT}, level::HIGH, "A.");
+   server.start(0ms);
+
+   auto without = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   server.add_statistics();
+   request(server.port(), "GET /?level=x HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto with = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   
+   server.stop();
+
+   // Statistics are read while formatting the response, so the current request is not counted yet.
+   BOOST_CHECK_EQUAL(1, without["items"].Size());
+   
+   map<string, const json::Value*> items;
+   for (unsigned i = 0; i < with["items"].Size(); ++i) {
+      items[with["items"][i]["key"].GetString()] = &with["items"][i];
+   }
+   BOOST_REQUIRE(items.count("/glo/server/requests:count"));
+   BOOST_CHECK_EQUAL(2, (*items["/glo/server/requests:count"])["value"].GetUint64());
+   BOOST_REQUIRE(items.count("/glo/server/errors:count"));
+   BOOST_CHECK_EQUAL(1, (*items["/glo/server/errors:count"])["value"].GetUint64());
+   BOOST_REQUIRE(items.count("/glo/server/sent:size-total"));
+   BOOST_CHECK((*items["/glo/server/sent:size-total"])["value"].GetUint64() > 0);
+   BOOST_REQUIRE(items.count("/glo/server/items:last"));
+   BOOST_CHECK_EQUAL(1, (*items["/glo/server/items:last"])["value"].GetUint64());
+   BOOST_REQUIRE(items.count("/glo/server/format:duration-count"));
+   BOOST_CHECK_EQUAL(1, (*items["/glo/server/format:duration-count"])["value"].GetUint64());
+   BOOST_CHECK(items.count("/glo/server/lock/hold:duration-p99"));
+   BOOST_CHECK(items.count("/glo/server/callback/slow:count"));
+}
+
+BOOST_AUTO_TEST_CASE(test_metrics_path_serves_prometheus_text)
+{
+   uint32_t a = 5;
+   http_status_server server;
+   server.add(&a, "/cache/a", {tag::COUNT}, level::HIGH, "A.");
+   server.start(10s);
+
+   auto metrics = request(server.port(), "GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto filtered = request(server.port(), "GET /metrics?prefix=%2Fother HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto json = request(server.port(), "GET /other HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   
+   server.stop();
+
+   BOOST_CHECK(metrics.raw.find("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n") != string::npos);
+   BOOST_CHECK_EQUAL("# HELP cache_a_count A.\n# TYPE cache_a_count counter\ncache_a_count 5\n", metrics.data());
+   BOOST_CHECK_EQUAL("", filtered.data());
+   BOOST_CHECK_EQUAL(1, json["items"].Size());
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_format_leaves_out_known_schema)
+{
+   uint32_t a = 5;
+   http_status_server server;
+   server.add(&a, "/cache/a", {tag::COUNT}, level::HIGH, "A.");
+   server.start(10s);
+
+   auto full = request(server.port(), "GET /?format=binary HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto full_data = full.data();
+   BOOST_REQUIRE(full_data.size() > BINARY_HEADER_SIZE);
+   auto schema_version = binary_read_u64(full_data.data() + BINARY_SCHEMA_VERSION_OFFSET);
+   auto by_accept = request(server.port(), "GET /?schema=" + to_string(schema_version) + " HTTP/1.1\r\n"
+                            "Accept: application/x-glo-binary\r\nConnection: close\r\n\r\n");
+   auto json = request(server.port(), "GET /?schema=1 HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   
+   server.stop();
+
+   BOOST_CHECK(full.raw.find("Content-Type: application/x-glo-binary\r\n") != string::npos);
+   BOOST_CHECK_EQUAL("GLOB", full_data.substr(0, 4));
+   BOOST_CHECK_EQUAL(BINARY_FORMAT_VERSION, binary_read_u32(full_data.data() + 4));
+   BOOST_CHECK_EQUAL(1, binary_read_u32(full_data.data() + 24));
+   auto schema_size = binary_read_u32(full_data.data() + BINARY_SCHEMA_SIZE_OFFSET);
+   BOOST_CHECK_EQUAL(BINARY_HEADER_SIZE + schema_size + 8 + 8, full_data.size());
+   BOOST_CHECK_EQUAL(5, binary_read_u64(full_data.data() + full_data.size() - 8));
+
+   auto data = by_accept.data();
+   BOOST_REQUIRE_EQUAL(BINARY_HEADER_SIZE + 8 + 8, data.size());
+   BOOST_CHECK_EQUAL(full_data.substr(0, BINARY_SCHEMA_SIZE_OFFSET), data.substr(0, BINARY_SCHEMA_SIZE_OFFSET));
+   BOOST_CHECK_EQUAL(0, binary_read_u32(data.data() + BINARY_SCHEMA_SIZE_OFFSET));
+   BOOST_CHECK_EQUAL(full_data.substr(BINARY_HEADER_SIZE + schema_size), data.substr(BINARY_HEADER_SIZE));
+   BOOST_CHECK_EQUAL(1, json["items"].Size());
+}
+
+BOOST_AUTO_TEST_CASE(test_delta_response_has_only_changed_items)
+{
+   atomic<uint32_t> a(1);
+   atomic<uint32_t> b(2);
+   atomic<uint32_t> c(3);
+   http_status_server server;
+   server.add(cref(a), "/a", {tag::COUNT}, 0, "A.");
+   server.add(cref(b), "/b", {tag::COUNT}, 0, "B.");
+   server.start(0ms);
+
+   auto plain = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto full = request(server.port(), "GET /?since=0 HTTP/1.1\r\nConnection: close\r\n\r\n");
+   auto generation = full.json()["generation"].GetUint64();
+   auto since = to_string(generation);
+   auto not_modified = request(server.port(), "GET /?since=" + since + " HTTP/1.1\r\nConnection: close\r\n\r\n");
+   b = 20;
+   server.add(cref(c), "/c", {tag::COUNT}, 0, "C.");
+   auto delta = request(server.port(), "GET / HTTP/1.1\r\nIf-None-Match: \"" + since + "\"\r\nConnection: close\r\n\r\n");
+   auto unknown = request(server.port(), "GET /?since=1 HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   
+   server.stop();
+
+   // Changes are only tracked for requests asking for them.
+   BOOST_CHECK(plain.raw.find("ETag") == string::npos);
+   BOOST_CHECK(plain.data().find("generation") == string::npos);
+   BOOST_CHECK(full.raw.find("ETag: \"" + since + "\"\r\n") != string::npos);
+   BOOST_CHECK_EQUAL(2, full.json()["items"].Size());
+   BOOST_CHECK_EQUAL("HTTP/1.1 304 Not Modified", not_modified.status());
+   BOOST_CHECK_EQUAL("", not_modified.data());
+
+   auto delta_json = delta.json();
+   BOOST_CHECK(delta_json["generation"].GetUint64() > generation);
+   BOOST_CHECK_EQUAL(generation, delta_json["since"].GetUint64());
+   BOOST_REQUIRE_EQUAL(2, delta_json["items"].Size());
+   BOOST_CHECK_EQUAL("/b:count", delta_json["items"][0]["key"].GetString());
+   BOOST_CHECK_EQUAL(20, delta_json["items"][0]["value"].GetUint64());
+   BOOST_CHECK_EQUAL("/c:count", delta_json["items"][1]["key"].GetString());
+   BOOST_CHECK_EQUAL(0, delta_json["removed"].Size());
+   BOOST_CHECK_EQUAL(3, unknown["items"].Size());
+}
+
+// Server tracking changes of items with the given keys.
+struct delta_tracking_server : http_status_server
+{
+   std::shared_ptr<const delta_state> track(const vector<string>& keys,
+                                            const std::shared_ptr<const delta_state>& previous)
+   {
+      content.clear();
+      item_begins.clear();
+      for (auto& key : keys) {
+         if (not item_begins.empty()) content.append(',');
+         item_begins.push_back(content.size());
+         content.append("{\"key\":\"" + key + "\",\"value\":1}");
+      }
+      return track_changes(content, item_begins, content.size(), previous);
+   }
+
+   write_buffer content;
+   vector<size_t> item_begins;
+};
+
+BOOST_AUTO_TEST_CASE(test_delta_state_shares_removed_keys_and_forgets_keys_added_again)
+{
+   delta_tracking_server server;
+   auto first = server.track({"/a", "/b"}, nullptr);
+   auto removed = server.track({"/a"}, first);
+   BOOST_REQUIRE(removed->removed);
+   BOOST_CHECK_EQUAL("/b", removed->removed->key);
+   BOOST_CHECK_EQUAL(removed->generation, removed->removed->generation);
+   BOOST_CHECK_EQUAL(1, removed->removed_count);
+
+   auto same = server.track({"/a"}, removed);
+   BOOST_CHECK_EQUAL(removed->generation, same->generation);
+   BOOST_CHECK(removed->removed == same->removed);
+
+   auto added = server.track({"/a", "/b"}, same);
+   BOOST_CHECK(not added->removed);
+   BOOST_CHECK_EQUAL(0, added->removed_count);
+   BOOST_REQUIRE_EQUAL(2, added->entries.size());
+   BOOST_CHECK_EQUAL(added->generation, added->entries[1].changed);
+}
+
+BOOST_AUTO_TEST_CASE(test_serve_on_unix_socket_path_and_remove_it)
+{
+   uint16_t var = 1;
+   string path = "/tmp/glo-test-" + to_string(getpid()) + ".sock";
+   {
+      http_status_server server{unix_socket(path)};
+      server.add(&var, "/val", {}, 0, "");
+      BOOST_CHECK_EQUAL(0, server.port());
+      std::thread t([&server]() { server.serve_once(10s); });
+      auto response = request_unix(path, "GET / HTTP/1.1\r\n\r\n");
+      t.join();
+      BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", response.status());
+      BOOST_CHECK(response.data().find("\"/val:\"") != string::npos);
+   }
+   BOOST_CHECK_EQUAL(-1, access(path.c_str(), F_OK));
+}
+
+BOOST_AUTO_TEST_CASE(test_serve_on_abstract_unix_socket_alongside_tcp)
+{
+   uint16_t var = 1;
+   string path = "@glo-test-" + to_string(getpid());
+   http_status_server server;
+   server.listen_unix(unix_socket(path));
+   server.add(&var, "/val", {}, 0, "");
+   BOOST_CHECK_THROW(http_status_server{unix_socket(path)}, os_error);
+   
+   std::thread t([&server]() { server.serve_once(10s); server.serve_once(10s); });
+   auto unix_response = request_unix(path, "GET / HTTP/1.1\r\n\r\n");
+   auto tcp_response = request(server.port(), "GET / HTTP/1.1\r\n\r\n");
+   t.join();
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", unix_response.status());
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", tcp_response.status());
+}
+
+BOOST_AUTO_TEST_CASE(test_listen_unix_while_serving_under_load)
+{
+   uint16_t var = 1;
+   string path = "@glo-test-load-" + to_string(getpid());
+   http_status_server server;
+   server.add(&var, "/val", {}, 0, "");
+   server.start(0ms);
+
+   atomic<bool> done(false);
+   atomic<uint32_t> ok(0);
+   vector<std::thread> clients;
+   for (int i = 0; i < 4; ++i) {
+      clients.emplace_back([&server, &done, &ok]() {
+            while (not done) {
+               auto response = request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+               if (response.status() == "HTTP/1.1 200 OK") ++ok;
+            }
+         });
+   }
+   this_thread::sleep_for(20ms);
+   server.listen_unix(unix_socket(path));
+   auto unix_response = request_unix(path, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+   done = true;
+   for (auto& client : clients) {
+      client.join();
+   }
+   server.stop();
+
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", unix_response.status());
+   BOOST_CHECK(ok > 0);
+   BOOST_CHECK_THROW(server.listen_unix(unix_socket(path + "-2")), os_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_embedded_server_is_driven_by_application_event_loop)
+{
+   // The application event loop, outliving the server that tells it to stop waiting for the sockets when destructed.
+   int loop = epoll_create1(EPOLL_CLOEXEC);
+   close_guard guard(loop);
+   map<int, uint32_t> interests;
+
+   uint16_t var = 1;
+   http_status_server server;
+   server.add(&var, "/val", {}, 0, "");
+   server.embed([loop, &interests](int fd, uint32_t events) {
+         epoll_event event{};
+         event.events = events;
+         event.data.fd = fd;
+         int op = events == 0 ? EPOLL_CTL_DEL : interests.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+         BOOST_REQUIRE_EQUAL(0, epoll_ctl(loop, op, fd, &event));
+         if (events == 0) interests.erase(fd);
+         else interests[fd] = events;
+      });
+   BOOST_CHECK_EQUAL(1, interests.size());
+   BOOST_CHECK(server.next_deadline() == chrono::steady_clock::time_point::max());
+
+   // Run the loop until done, calling on_deadline like an application would.
+   auto serve_until = [&server, loop](function<bool()> done) {
+      auto end = chrono::steady_clock::now() + 10s;
+      while (not done()) {
+         BOOST_REQUIRE(chrono::steady_clock::now() < end);
+         epoll_event events[8];
+         int count = epoll_wait(loop, events, 8, 10);
+         for (int i = 0; i < count; ++i) {
+            server.on_ready(events[i].data.fd, events[i].events);
+         }
+         if (chrono::steady_clock::now() >= server.next_deadline()) {
+            server.on_deadline();
+         }
+      }
+   };
+
+   // An open idle connection gives a deadline, it is gone when the client closes.
+   boost::asio::io_service svc;
+   boost::asio::ip::tcp::socket idle(svc);
+   idle.connect({ {}, server.port() });
+   auto response = std::async(std::launch::async, [&server]() {
+         return request(server.port(), "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+      });
+   serve_until([&]() { return response.wait_for(0s) == std::future_status::ready and interests.size() == 2; });
+   BOOST_CHECK_EQUAL("HTTP/1.1 200 OK", response.get().status());
+   BOOST_CHECK(server.next_deadline() < chrono::steady_clock::now() + 3s);
+
+   idle.close();
+   serve_until([&]() { return interests.size() == 1; });
+   BOOST_CHECK(server.next_deadline() == chrono::steady_clock::time_point::max());
+}
+
+BOOST_AUTO_TEST_CASE(test_history_returns_sampled_values)
+{
+   atomic<uint32_t> count(0);
+   string str = "str";
+   http_status_server server;
+   server.add(cref(count), "/count", {tag::COUNT}, 0, "");
+   server.add(&str, "/str", {}, 0, "");
+   server.start(0ms);
+
+   server.start_sampler(5ms, 8);
+   for (int i = 0; i < 20; ++i) {
+      ++count;
+      this_thread::sleep_for(5ms);
+   }
+   server.stop_sampler();
+   
+   auto response = request(server.port(), "GET /?history=60 HTTP/1.1\r\nConnection: close\r\n\r\n");
+   BOOST_REQUIRE_EQUAL("HTTP/1.1 200 OK", response.status());
+   auto json = response.json();
+   BOOST_REQUIRE(json.IsObject());
+   BOOST_CHECK_EQUAL(0.005, json["interval"].GetDouble());
+   // How many samples were taken depends on scheduling, but never more than the history holds.
+   auto& timestamps = json["timestamps"];
+   BOOST_REQUIRE_GE(timestamps.Size(), 1);
+   BOOST_REQUIRE_LE(timestamps.Size(), 8);
+   auto& items = json["items"];
+   BOOST_REQUIRE_EQUAL(2, items.Size());
+   BOOST_CHECK_EQUAL("/count:count", string(items[0u]["key"].GetString()));
+   auto& values = items[0u]["values"];
+   BOOST_REQUIRE_EQUAL(timestamps.Size(), values.Size());
+   for (unsigned i = 1; i < values.Size(); ++i) {
+      BOOST_CHECK_LT(timestamps[i - 1].GetDouble(), timestamps[i].GetDouble());
+      BOOST_CHECK_LE(values[i - 1].GetUint64(), values[i].GetUint64());
+   }
+   BOOST_CHECK(items[1u]["values"][0u].IsNull());
+
+   // Only samples from the last seconds are returned.
+   this_thread::sleep_for(50ms);
+   auto recent = request(server.port(), "GET /?history=0.02 HTTP/1.1\r\nConnection: close\r\n\r\n").json();
+   server.stop();
+   BOOST_CHECK_EQUAL(0, recent["timestamps"].Size());
+   BOOST_CHECK_EQUAL(0, recent["items"][0u]["values"].Size());
+}
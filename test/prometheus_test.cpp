@@ -0,0 +1,128 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+BOOST_AUTO_TEST_CASE(test_prometheus_spec_maps_tags_to_name_suffix_labels_and_type)
+{
+   prometheus_spec count({tag::COUNT}, "Number of \\ things.\nMore.");
+   BOOST_CHECK_EQUAL("_count", count.suffix);
+   BOOST_CHECK_EQUAL("", count.labels);
+   BOOST_CHECK_EQUAL("counter", count.type);
+   BOOST_CHECK_EQUAL("Number of \\\\ things.\\nMore.", count.help);
+
+   prometheus_spec size({tag::SIZE}, "");
+   BOOST_CHECK_EQUAL("gauge", size.type);
+
+   prometheus_spec current_size({tag::SIZE, tag::TOTAL, tag::CURRENT}, "");
+   BOOST_CHECK_EQUAL("_size_total_current", current_size.suffix);
+   BOOST_CHECK_EQUAL("gauge", current_size.type);
+
+   prometheus_spec p99({tag::DURATION, tag::P99}, "");
+   BOOST_CHECK_EQUAL("_duration", p99.suffix);
+   BOOST_CHECK_EQUAL("{quantile=\"0.99\"}", p99.labels);
+   BOOST_CHECK_EQUAL("gauge", p99.type);
+
+   prometheus_spec none({}, "");
+   BOOST_CHECK_EQUAL("", none.suffix);
+   BOOST_CHECK_EQUAL("untyped", none.type);
+}
+
+BOOST_AUTO_TEST_CASE(test_prometheus_value_converts_json_values)
+{
+   auto convert = [](const char* json) {
+      write_buffer buf;
+      buf.append("x ");
+      buf.append(json);
+      return prometheus_value(buf, 2) ? buf.str().substr(2) : "-";
+   };
+   BOOST_CHECK_EQUAL("12", convert("12"));
+   BOOST_CHECK_EQUAL("-1.5e-07", convert("-1.5e-07"));
+   BOOST_CHECK_EQUAL("1", convert("true"));
+   BOOST_CHECK_EQUAL("0", convert("false"));
+   BOOST_CHECK_EQUAL("NaN", convert("nan"));
+   BOOST_CHECK_EQUAL("+Inf", convert("inf"));
+   BOOST_CHECK_EQUAL("-", convert("\"str\""));
+   BOOST_CHECK_EQUAL("-", convert("{\"a\":1}"));
+   BOOST_CHECK_EQUAL("-", convert(""));
+}
+
+BOOST_AUTO_TEST_CASE(test_group_prometheus_format_items)
+{
+   uint32_t count = 3;
+   bool flag = true;
+   string str = "str";
+   histogram h;
+   h.record(100);
+   group root;
+   auto child = make_shared<group>("/child");
+   root.add_group(child, "/root");
+   child->add(&count, "/requests", {tag::COUNT}, 0, "Requests.");
+   child->add(&flag, "/flag", {}, 0, "A flag.");
+   child->add(&str, "/str", {}, 0, "Not numeric.");
+   child->add(&h, "/latency", {}, 0, "Latency.");
+   
+   write_buffer buf;
+   auto items = root.prometheus_format_items(buf, glo::filter());
+
+   BOOST_CHECK_EQUAL(2 + 1, items);
+   auto text = buf.str();
+   BOOST_CHECK_EQUAL("# HELP root_child_requests_count Requests.\n"
+                     "# TYPE root_child_requests_count counter\n"
+                     "root_child_requests_count 3\n"
+                     "# HELP root_child_flag A flag.\n"
+                     "# TYPE root_child_flag untyped\n"
+                     "root_child_flag 1\n"
+                     "# HELP root_child_latency_duration Latency.\n"
+                     "# TYPE root_child_latency_duration histogram\n"
+                     "root_child_latency_duration_bucket{le=\"0\"} 0\n",
+                     text.substr(0, text.find("root_child_latency_duration_bucket{le=\"1\"}")));
+   BOOST_CHECK(text.find("\nroot_child_latency_duration_bucket{le=\"63\"} 0\n"
+                         "root_child_latency_duration_bucket{le=\"127\"} 1\n") != string::npos);
+   BOOST_CHECK(text.find("\nroot_child_latency_duration_bucket{le=\"9223372036854775807\"} 1\n"
+                         "root_child_latency_duration_bucket{le=\"+Inf\"} 1\n"
+                         "root_child_latency_duration_sum 100\n"
+                         "root_child_latency_duration_count 1\n") != string::npos);
+   BOOST_CHECK(text.find("# TYPE root_child_latency_duration_") == string::npos);
+   BOOST_CHECK(text.find("str") == string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_group_prometheus_format_prefixes_names_starting_with_digit)
+{
+   uint32_t count = 3;
+   group root;
+   root.add(&count, "/1x", {}, 0, "Digit.");
+
+   write_buffer buf;
+   BOOST_CHECK_EQUAL(1, root.prometheus_format_items(buf, glo::filter()));
+   BOOST_CHECK_EQUAL("# HELP _1x Digit.\n"
+                     "# TYPE _1x untyped\n"
+                     "_1x 3\n",
+                     buf.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_group_prometheus_format_groups_samples_by_metric_name)
+{
+   uint32_t p50 = 1;
+   uint32_t other = 2;
+   uint32_t p99 = 3;
+   group root;
+   root.add(&p50, "/latency", {tag::P50}, 0, "Latency.");
+   root.add(&other, "/other", {}, 0, "Other.");
+   root.add(&p99, "/latency", {tag::P99}, 0, "Latency.");
+
+   write_buffer buf;
+   BOOST_CHECK_EQUAL(3, root.prometheus_format_items(buf, glo::filter()));
+   BOOST_CHECK_EQUAL("# HELP latency Latency.\n"
+                     "# TYPE latency gauge\n"
+                     "latency{quantile=\"0.5\"} 1\n"
+                     "latency{quantile=\"0.99\"} 3\n"
+                     "# HELP other Other.\n"
+                     "# TYPE other untyped\n"
+                     "other 2\n",
+                     buf.str());
+}
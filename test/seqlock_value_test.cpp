@@ -0,0 +1,88 @@
+#include <future>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+struct seqlock_test_stats
+{
+   uint64_t count;
+   uint32_t size;
+   double ratio;
+   uint64_t check[4];
+};
+
+
+BOOST_AUTO_TEST_CASE(test_seqlock_value_store_update_and_load)
+{
+   seqlock_value<seqlock_test_stats> val;
+   BOOST_CHECK_EQUAL(0, val.load().count);
+   val.store({1, 2, 0.5, {}});
+   val.update([](seqlock_test_stats& s) { ++s.count; });
+   auto copy = val.load();
+   BOOST_CHECK_EQUAL(2, copy.count);
+   BOOST_CHECK_EQUAL(2, copy.size);
+   BOOST_CHECK_EQUAL(0.5, copy.ratio);
+
+   group g;
+   g.add(&val, "/stats", {{&seqlock_test_stats::count, "/count", {}, 0, ""}});
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK_EQUAL(R""({"key":"/stats/count:","level":0,"desc":"","value":2})"", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_seqlock_value_load_is_never_torn)
+{
+   seqlock_value<seqlock_test_stats> val;
+   atomic<bool> done(false);
+   thread writer([&]() {
+         for (uint64_t i = 1; i < 200000; ++i) {
+            val.update([i](seqlock_test_stats& s) {
+                  s.count = i;
+                  for (auto& c : s.check) c = i;
+               });
+         }
+         done = true;
+      });
+   uint64_t torn = 0;
+   while (not done) {
+      auto copy = val.load();
+      for (auto c : copy.check) {
+         torn += c != copy.count;
+      }
+   }
+   writer.join();
+   BOOST_CHECK_EQUAL(0, torn);
+}
+
+BOOST_AUTO_TEST_CASE(test_format_seqlock_value_fields_as_items)
+{
+   auto mutex = make_shared<std::mutex>();
+   auto val = make_shared<seqlock_value<seqlock_test_stats>>(seqlock_test_stats{12, 3, 0.25, {}});
+   group g(mutex);
+   g.add(val, "/stats", {
+         {&seqlock_test_stats::count, "/count", {tag::COUNT}, level::HIGH, "Count."},
+         {&seqlock_test_stats::size, "/size", {tag::SIZE}, level::LOW, "Size."},
+         {&seqlock_test_stats::ratio, "/ratio", {}, level::LOW, "Ratio."},
+      });
+
+   std::lock_guard<std::mutex> lock(*mutex);
+   auto result = std::async(std::launch::async, [&g]() {
+         stringstream ss;
+         const char* delimiter = "";
+         glo::filter filter;
+         filter.max_level = level::LOW;
+         g.json_format_items(ss, "", delimiter, filter);
+         return ss.str();
+      });
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   BOOST_CHECK_EQUAL(R""({"key":"/stats/count:count","level":1,"desc":"Count.","value":12},)""
+                     R""({"key":"/stats/size:size","level":3,"desc":"Size.","value":3},)""
+                     R""({"key":"/stats/ratio:","level":3,"desc":"Ratio.","value":0.25})"", result.get());
+}
@@ -0,0 +1,61 @@
+#include <future>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+BOOST_AUTO_TEST_CASE(test_sharded_counter_sums_increments_from_all_threads)
+{
+   sharded_counter counter;
+   vector<thread> threads;
+   for (uint32_t i = 0; i < 2 * SHARDED_COUNTER_SLOTS; ++i) {
+      threads.emplace_back([&counter]() {
+            for (uint32_t j = 0; j < 1000; ++j) {
+               ++counter;
+            }
+            counter += 10;
+         });
+   }
+   for (auto& t : threads) {
+      t.join();
+   }
+   BOOST_CHECK_EQUAL(2 * SHARDED_COUNTER_SLOTS * 1010, counter.load());
+}
+
+BOOST_AUTO_TEST_CASE(test_format_sharded_counter_is_tagged_count)
+{
+   sharded_counter counter;
+   counter.add(12);
+   group g;
+   g.add(&counter, "/hits", {}, 0, "Hits.");
+   g.add(cref(counter), "/hits_ref", {tag::COUNT}, 0, "Hits.");
+   stringstream ss;
+   const char* delimiter = "";
+   g.json_format_items(ss, "", delimiter);
+   BOOST_CHECK_EQUAL(R""({"key":"/hits:count","level":0,"desc":"Hits.","value":12},)""
+                     R""({"key":"/hits_ref:count","level":0,"desc":"Hits.","value":12})"", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_ptr_to_sharded_counter_does_not_lock_mutex)
+{
+   auto mutex = make_shared<std::mutex>();
+   auto counter = make_shared<sharded_counter>();
+   ++*counter;
+   group g(mutex);
+   g.add(counter, "/hits", {}, 0, "");
+   
+   std::lock_guard<std::mutex> lock(*mutex);
+   auto result = std::async(std::launch::async, [&g]() {
+         stringstream ss;
+         const char* delimiter = "";
+         g.json_format_items(ss, "", delimiter);
+         return ss.str();
+      });
+   BOOST_REQUIRE(result.wait_for(10s) == std::future_status::ready);
+   BOOST_CHECK(result.get().find("\"value\":1}") != string::npos);
+}
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <boost/test/unit_test.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <glo.hpp>
+
+using namespace glo;
+using namespace std;
+
+
+string shm_test_path(const string& name)
+{
+   return "/dev/shm/glo-test-" + to_string(getpid()) + "-" + name;
+}
+
+
+BOOST_AUTO_TEST_CASE(test_shm_reader_reads_refreshed_values)
+{
+   uint32_t a = 3;
+   atomic<int64_t> b(-2);
+   auto path = shm_test_path("values");
+   shm_exporter exporter(path);
+   exporter.add(&a, "/a", {tag::COUNT}, 1, "A.");
+   exporter.add(cref(b), "/b", {}, 2, "");
+
+   shm_reader reader(path);
+   write_buffer data;
+   BOOST_CHECK(not reader.load(data));
+
+   BOOST_CHECK_EQUAL(2, exporter.refresh());
+   BOOST_REQUIRE(reader.load(data));
+   vector<binary_item> items;
+   BOOST_REQUIRE(binary_parse(data.data(), data.size(), items));
+   BOOST_REQUIRE_EQUAL(2, items.size());
+   BOOST_CHECK_EQUAL("/a:count", items[0].key);
+   BOOST_CHECK_EQUAL(1, items[0].level);
+   BOOST_CHECK_EQUAL("A.", items[0].desc);
+   BOOST_CHECK_EQUAL(3, items[0].number());
+   BOOST_CHECK_EQUAL("/b:", items[1].key);
+   BOOST_CHECK_EQUAL(-2, items[1].number());
+
+   a = 4;
+   BOOST_REQUIRE(reader.load(data));
+   BOOST_REQUIRE(binary_parse(data.data(), data.size(), items));
+   BOOST_CHECK_EQUAL(3, items[0].number());
+   exporter.refresh();
+   BOOST_REQUIRE(reader.load(data));
+   BOOST_REQUIRE(binary_parse(data.data(), data.size(), items));
+   BOOST_CHECK_EQUAL(4, items[0].number());
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_reader_gets_consistent_data_while_file_grows)
+{
+   auto path = shm_test_path("grow");
+   shm_exporter exporter(path);
+   vector<unique_ptr<uint64_t>> values;
+   exporter.refresh();
+   shm_reader reader(path);
+
+   exporter.start(0ms);
+   write_buffer data;
+   vector<binary_item> items;
+   for (uint64_t i = 0; i < 2000; ++i) {
+      values.push_back(make_unique<uint64_t>(i));
+      exporter.add(values.back().get(), "/value/" + to_string(i), {}, 0, "");
+      BOOST_REQUIRE(reader.load(data));
+      BOOST_REQUIRE(binary_parse(data.data(), data.size(), items));
+      for (uint64_t j = 0; j < items.size(); ++j) {
+         BOOST_REQUIRE_EQUAL(j, items[j].number());
+      }
+   }
+   exporter.stop();
+   exporter.refresh();
+   BOOST_REQUIRE(reader.load(data));
+   BOOST_REQUIRE(binary_parse(data.data(), data.size(), items));
+   BOOST_CHECK_EQUAL(2000, items.size());
+   BOOST_CHECK_GT(data.size(), 4096);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_file_is_removed_with_exporter)
+{
+   auto path = shm_test_path("remove");
+   {
+      shm_exporter exporter(path);
+      BOOST_CHECK_EQUAL(0, access(path.c_str(), F_OK));
+   }
+   BOOST_CHECK_EQUAL(-1, access(path.c_str(), F_OK));
+}